@@ -29,7 +29,8 @@ enum class LossType { MSE, BCE };
 
 void load(string file, int batch_sz
   , TunerType tuner_type = TunerType::Static
-  , LossType loss_type = LossType::MSE)
+  , LossType loss_type = LossType::MSE
+  , int threads = 0)
 {
   unique_ptr<Loss> loss;
   switch (loss_type)
@@ -54,9 +55,11 @@ void load(string file, int batch_sz
       break;
   }
 
+  g_tuner->set_threads(threads);
   g_tuner->open(file);
 
   log("Positions: {}\n", g_tuner->size());
+  log("Threads: {}\n", g_tuner->get_threads());
   report_num_threads();
 }
 
@@ -93,7 +96,8 @@ PYBIND11_MODULE(eia_tuner, m)
   m.def("load",  &load, "Load dataset with given batch size"
     , py::arg("file"), py::arg("batch_size")
     , py::arg("tuner_type") = TunerType::Static
-    , py::arg("loss_type") = LossType::MSE);
+    , py::arg("loss_type") = LossType::MSE
+    , py::arg("threads") = 0);
   m.def("base",  &base,  "Get the basis tune");
   m.def("score", &score, "Loss score for tune");
 }
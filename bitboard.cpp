@@ -28,7 +28,7 @@ void print64(u64 bb)
   cout << BitBoard{bb} << endl;
 }
 
-constexpr u64 shift(u64 bb, Dir dir)
+u64 shift(u64 bb, Dir dir)
 {
   switch (dir)
   {
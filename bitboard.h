@@ -103,7 +103,7 @@ INLINE u64 shift_dl(u64 bb) { return (bb & ~FileA) >> 9; }
 INLINE u64 shift_dr(u64 bb) { return (bb & ~FileH) >> 7; }
 
 enum class Dir {U, D, L, R, UL, UR, DL, DR};
-extern constexpr u64 shift(u64 bb, Dir dir);
+u64 shift(u64 bb, Dir dir);
 
 constexpr u64 sA1 = bit(A1);
 constexpr u64 sA2 = bit(A2);
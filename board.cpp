@@ -11,8 +11,20 @@ using namespace std;
 
 namespace eia {
 
+Duo psq[Piece_N][SQ_N];
+
 Board::Board(const Board & board)
 {
+  *this = board;
+}
+
+// Copy takes only keys since the last irreversible move, older
+//  ones can't repeat, and no states - the copy starts a new root
+
+Board & Board::operator = (const Board & board)
+{
+  if (this == &board) return *this;
+
   for (Piece p = BP; p < Piece_N; ++p) piece[p] = board.piece[p];
   for (SQ sq = A1; sq < SQ_N; ++sq) square[sq] = board.square[sq];
 
@@ -20,7 +32,15 @@ Board::Board(const Board & board)
   occ[1] = board.occ[1];
   color  = board.color;
   state  = board.state;
+  mkey   = board.mkey;
   moves_cnt = board.moves_cnt;
+
+  const size_t n = std::min<size_t>(board.keys.size(), board.state.fifty);
+  keys.assign(board.keys.end() - n, board.keys.end());
+  states.clear();
+  refresh_acc(); // net could be switched on after board was set
+
+  return *this;
 }
 
 void Board::clear()
@@ -31,18 +51,27 @@ void Board::clear()
   color = White;
   occ[0] = occ[1] = Empty;
   state = State();
-  state_ptr = &states[0];
+  states.clear();
+  keys.clear();
 
   moves_cnt = 0;
-  for (int i = 0; i < 8192; ++i)
-    threefold[i] = 0ull;
-
   mkey = MatKey::Init;
+  refresh_acc();
 }
 
 void Board::revert_states()
 {
-  state_ptr = &states[0];
+  states.clear();
+  accs.clear();
+}
+
+// Accumulator from scratch, history of it is dropped as
+//  well as by revert_states(), so it's for the root only
+
+void Board::refresh_acc()
+{
+  accs.clear();
+  if (Nnue::on) Nnue::refresh(acc, square);
 }
 
 int Board::phase() const
@@ -86,14 +115,15 @@ bool Board::is_repetition() const
 {
   const u64 key = hash();
 
-  // Going until first irreversible move
+  // Going back until first irreversible move
   // Position must repeat twice
 
-  for (int i = moves_cnt - 5; i >= 0; i -= 2)
-  {
-    if (i < moves_cnt - state.fifty) break;
-    if (threefold[i] == key) return true;
-  }
+  const int n = static_cast<int>(keys.size());
+  const int last = (std::min)(n, state.fifty);
+
+  for (int i = 4; i <= last; i += 2)
+    if (keys[n - i] == key) return true;
+
   return false;
 }
 
@@ -101,7 +131,7 @@ bool Board::is_simply_mated() const
 {
   if (!state.checkers) return false;
 
-  const u64 o = occ[color] | state.threats;
+  const u64 o = occ[color] | threats();
   const SQ  ksq = bitscan(piece[BK ^ color]);
   const u64 katt = atts[BK][ksq];
   const u64 kmov = (o & katt) ^ katt;
@@ -144,12 +174,12 @@ u64 Board::calc_hash() const
   return color ? key : key ^ Zobrist::turn;
 }
 
-bool Board::set(string fen)
+bool Board::set(std::string_view fen)
 {
   SQ sq = A8;
   clear();
 
-  string fen_board = cut(fen); // parsing main part
+  std::string_view fen_board = cut(fen); // parsing main part
   for (char ch : fen_board)
   {
     if (isdigit(ch)) sq += ch - '0';
@@ -169,37 +199,58 @@ bool Board::set(string fen)
     }
   }
 
-  string fen_color = cut(fen); // parsing color
+  std::string_view fen_color = cut(fen); // parsing color
   for (char ch : fen_color)
     color = to_color(ch);
 
-  string fen_castling = cut(fen); // parsing castling
+  std::string_view fen_castling = cut(fen); // parsing castling
   state.castling = Castling::NO;
   for (char ch : fen_castling)
   {
     state.castling |= to_castling(ch);
   }
 
-  string fen_ep = cut(fen); // parsing en passant
+  std::string_view fen_ep = cut(fen); // parsing en passant
   state.ep = to_sq(fen_ep);
 
-  string fen_fifty = cut(fen); // fifty move counter
+  std::string_view fen_fifty = cut(fen); // fifty move counter
   state.fifty = parse_int(fen_fifty);
 
-  string fen_cnt = cut(fen); // full move counter
+  std::string_view fen_cnt = cut(fen); // full move counter
   moves_cnt = parse_int(fen_cnt);
 
   state.bhash ^= color ? Empty : Zobrist::turn;
 
   state.checkers = king_attackers();
-  state.threats = opp_attacks();
+  state.pinned = pinned();
 
   return true;
 }
 
 std::string Board::to_fen()
 {
-  std::string fen; // TODO
+  std::string fen;
+  for (int y = 7; y >= 0; --y)
+  {
+    int empty = 0;
+    for (int x = 0; x < 8; ++x)
+    {
+      const Piece p = square[to_sq(x, y)];
+      if (p == NOP) { empty++; continue; }
+
+      if (empty) fen += static_cast<char>('0' + empty);
+      fen += to_char(p);
+      empty = 0;
+    }
+    if (empty) fen += static_cast<char>('0' + empty);
+    if (y) fen += '/';
+  }
+
+  const std::string castling = eia::to_string(state.castling);
+  const std::string ep = state.ep != SQ_N ? eia::to_string(state.ep) : "-";
+
+  fen += format(" {} {} {} {} {}", to_char(color), castling.empty() ? "-" : castling,
+    ep, state.fifty, 1 + moves_cnt / 2);
   return fen;
 }
 
@@ -271,7 +322,7 @@ string Board::to_string() const
   return str;
 }
 
-INLINE u64 Board::attack(Piece p, SQ sq) const
+u64 Board::attack(Piece p, SQ sq) const
 {
   switch(pt(p))
   {
@@ -286,7 +337,7 @@ INLINE u64 Board::attack(Piece p, SQ sq) const
   return 0ull;
 }
 
-INLINE bool Board::is_attacked(SQ sq, u64 o, int opp) const
+bool Board::is_attacked(SQ sq, u64 o, int opp) const
 {
   const Color c = color ^ opp;
 
@@ -304,7 +355,7 @@ INLINE bool Board::is_attacked(SQ sq, u64 o, int opp) const
 }
 
 // used in SEE
-INLINE u64 Board::get_all_attackers(u64 o, SQ sq) const
+u64 Board::get_all_attackers(u64 o, SQ sq) const
 {
   u64 att = Empty;
   att |= b_att(o, sq) & diags();
@@ -316,14 +367,14 @@ INLINE u64 Board::get_all_attackers(u64 o, SQ sq) const
   return att;
 }
 
-INLINE bool Board::in_check(int opp) const
+bool Board::in_check(int opp) const
 {
   const Piece p = to_piece(King, color ^ opp);
   const SQ king = bitscan(piece[p]);
   return is_attacked(king, occupied(), opp);
 }
 
-INLINE bool Board::castling_attacked(SQ from, SQ to) const
+bool Board::castling_attacked(SQ from, SQ to) const
 {
   const u64 o = occupied();
   const SQ mid = middle(from, to);
@@ -333,17 +384,44 @@ INLINE bool Board::castling_attacked(SQ from, SQ to) const
       || is_attacked(to, o);
 }
 
-INLINE u64 Board::king_attackers(int opp) const
+u64 Board::king_attackers(int opp) const
 {
   return color ^ opp ? king_attrs<White>() : king_attrs<Black>();
 }
 
-INLINE u64 Board::opp_attacks() const
+// Checkers after the move: the moved piece itself or a slider
+//  behind its origin square, rare special moves go the full way
+
+u64 Board::move_checkers(SQ from, SQ to, MT mt) const
+{
+  if (mt != Quiet && mt != PawnMove && mt != Cap)
+    return king_attackers();
+
+  const SQ king = bitscan(piece[BK ^ color]);
+  const Piece p = square[to];
+
+  u64 att = is_slider(p) ? Empty : atts[opp(p)][king] & bit(to);
+
+  if (is_slider(p) || line[king][from]) // direct or discovered
+  {
+    const u64 o = occupied();
+    att |= b_att(o, king) & (piece[WB ^ color] | piece[WQ ^ color]);
+    att |= r_att(o, king) & (piece[WR ^ color] | piece[WQ ^ color]);
+  }
+  return att;
+}
+
+u64 Board::opp_attacks() const
 {
   return color ? opp_atts<White>() : opp_atts<Black>();
 }
 
-INLINE void Board::generate_all(MoveList & ml) const
+u64 Board::pinned() const
+{
+  return color ? pins<White>() : pins<Black>();
+}
+
+void Board::generate_all(MoveList & ml) const
 {
   if (color)
   {
@@ -357,22 +435,9 @@ INLINE void Board::generate_all(MoveList & ml) const
   }
 }
 
-void Board::generate_legal(MoveList & ml)
+void Board::generate_legal(MoveList & ml) const
 {
-  MoveList pseudo;
-
-  generate_all(pseudo);
-
-  while (!pseudo.empty())
-  {
-    Move move = pseudo.get_next();
-
-    if (make(move))
-    {
-      unmake(move);
-      ml.add(move);
-    }
-  }
+  generate_all(ml); // generators take pins and checks into account
 }
 
 int Board::see(Move move) const
@@ -433,13 +498,11 @@ Move Board::recognize(Move candidate)
   Move result = Move::None;
   MoveList ml;
 
-  generate_all(ml);
+  generate_legal(ml);
 
   while (!ml.empty())
   {
     Move move = ml.get_next();
-    if (!make(move)) continue;
-    unmake(move);
 
     if (similar(move, candidate))
     {
@@ -451,38 +514,45 @@ Move Board::recognize(Move candidate)
   return result;
 }
 
-Move Board::parse_san(string str)
+// SAN is short, so it's filtered into buffer on stack
+//  and parsed as view of it without any allocations
+
+Move Board::parse_san(std::string_view san)
 {
-  string old = str;
   char ch;
   Piece p;
-  PieceType pt, promote = PieceType_N;
+  PieceType pt = Pawn, promote = PieceType_N;
   u64 fr_mask = Full; // allowed
   u64 to_mask = Full; // squares
 
   auto is_file = [](char ch){ return ch >= 'a' && ch <= 'h'; };
   auto is_rank = [](char ch){ return ch >= '1' && ch <= '8'; };
 
-  if (str.length() < 2) return Move::None;
-  if (str == "--") return Move::Null;
+  if (san.length() < 2) return Move::None;
+  if (san == "--") return Move::Null;
 
   // 1. Qualifiers (discard all)
 
-  dry(str, "x+#!?");
-
-  size_t pos = str.rfind("e.p.");
-  if (pos != string::npos)
-    str.erase(pos, 4);
+  char buf[16];
+  size_t len = 0;
+  for (size_t i = 0; i < san.length(); ++i)
+  {
+    if (san.substr(i).starts_with("e.p.")) { i += 3; continue; }
+    if (index_of("x+#!?", san[i]) >= 0) continue;
+    if (len == sizeof(buf)) return Move::None;
+    buf[len++] = san[i];
+  }
+  std::string_view str(buf, len);
 
   // 2. Special cases
 
-  if (str == "O-O-O")
+  if (str == "O-O-O" || str == "0-0-0")
   {
     p = to_piece(King, color);
     fr_mask = bit(color ? E1 : E8);
     to_mask = bit(color ? C1 : C8);
   }
-  else if (str == "O-O")
+  else if (str == "O-O" || str == "0-0")
   {
     p = to_piece(King, color);
     fr_mask = bit(color ? E1 : E8);
@@ -492,21 +562,22 @@ Move Board::parse_san(string str)
   {
     // 3. Parsing piece type (if present)
 
-    if (cut_start(str, ch)) pt = to_pt(tolower(ch));
-    pt = pt == PieceType_N ? Pawn : pt;
+    if (!str.empty() && isupper(str[0]))
+    {
+      pt = to_pt(static_cast<char>(tolower(str[0])));
+      if (pt == PieceType_N) return Move::None;
+      str.remove_prefix(1);
+    }
     p = to_piece(pt, color);
 
-    // 4. Parsing promotion piece
+    // 4. Parsing promotion piece (e8=Q or e8Q)
 
-    if (pt == Pawn)
+    if (pt == Pawn && str.length() > 2
+    &&  (ch = static_cast<char>(tolower(str.back())), index_of("nbrq", ch) >= 0))
     {
-      while ((pos = str.rfind("=", pos)) != string::npos)
-      {
-        if (pos < str.length() - 1)
-        {
-          promote = to_pt(str[pos + 1]);
-        }
-      }
+      promote = to_pt(ch);
+      str.remove_suffix(1);
+      if (str.ends_with('=')) str.remove_suffix(1);
     }
 
     // a1a1 -> ss -> s|s
@@ -518,24 +589,30 @@ Move Board::parse_san(string str)
     // 5. Parsing from-to squares
 
     struct Token { char ch; SQ sq; u64 mask; };
-    vector<Token> tokens;
+    Token tokens[2];
+    int n = 0;
 
-    for (int i = 0; i < str.length() - 1; ++i)
+    for (int i = 0; i + 1 < str.length(); ++i)
     {
+      if (n == 2) return Move::None;
+
       if (is_file(str[i])      // fold complete squares
       &&  is_rank(str[i + 1])) // since they are integral
       {
-        SQ sq = to_sq(str.substr(i, 2));
-        tokens.push_back({ 's', sq });
+        tokens[n++] = { 's', to_sq(str.substr(i, 2)) };
         i++;
       }
-      else tokens.push_back({ str[i], SQ_N });
+      else tokens[n++] = { str[i], SQ_N };
     }
 
-    if (tokens.size() == 1)
-      tokens.insert(tokens.begin(), 1, { '_', SQ_N });
+    if (n == 1)
+    {
+      tokens[1] = tokens[0];
+      tokens[0] = { '_', SQ_N };
+      n = 2;
+    }
 
-    if (tokens.size() != 2) return Move::None;
+    if (n != 2) return Move::None;
 
     // 6. Build square masks
 
@@ -554,16 +631,14 @@ Move Board::parse_san(string str)
   // Searching in legal moves
 
   MoveList ml;
+  generate_legal(ml);
 
-  generate_all(ml);
-
-  Moves moves;
+  Move found = Move::None;
+  int count = 0;
 
   while (!ml.empty())
   {
     Move move = ml.get_next();
-    if (!make(move)) continue;
-    unmake(move);
 
     const SQ from = get_from(move);
     const SQ to = get_to(move);
@@ -572,22 +647,24 @@ Move Board::parse_san(string str)
     &&  bit(to) & to_mask    // Square to allowed
     &&  square[from] == p) // Moving piece equal
     {
-      if (pt != Pawn || promoted(move) == promote)
-        moves.push_back(move);
+      const PieceType prom = is_prom(move) ? promoted(move) : PieceType_N;
+      if (pt != Pawn || prom == promote)
+      {
+        found = move;
+        count++;
+      }
     }
   }
 
-  if (moves.size() == 0) return Move::None;
-  if (moves.size() == 1) return moves[0];
+  if (count == 1) return found;
 
 #ifdef _DEBUG
-  string msg;
-  for (auto move : moves)
-    msg += format("{}, ", move);
-
-  log("{}", to_string());
-  say("Ambigious {}, candidates are {}\n", old, msg);
-  assert(false);
+  if (count > 1)
+  {
+    log("{}", to_string());
+    say("Ambigious {}\n", san);
+    assert(false);
+  }
 #endif
 
   return Move::None;
@@ -662,13 +739,13 @@ bool Board::pseudolegal(Move move) const
       {
         return !!(state.castling & Castling::WK)
              && !(o & Span_WK) && (to == G1)
-             && !(state.threats & Path_WK);
+             && !(threats() & Path_WK);
       }
       else
       {
         return !!(state.castling & Castling::BK)
              && !(o & Span_BK) && (to == G8)
-             && !(state.threats & Path_BK);
+             && !(threats() & Path_BK);
       }
     }
     else if (mt == QCastle)
@@ -679,13 +756,13 @@ bool Board::pseudolegal(Move move) const
       {
         return !!(state.castling & Castling::WQ)
              && !(o & Span_WQ) && (to == C1)
-             && !(state.threats & Path_WQ);
+             && !(threats() & Path_WQ);
       }
       else
       {
         return !!(state.castling & Castling::BQ)
              && !(o & Span_BQ) && (to == C8)
-             && !(state.threats & Path_BQ);
+             && !(threats() & Path_BQ);
       }
     }
     else return is_castle(mt) || mt == Quiet || mt == Cap;
@@ -695,6 +772,24 @@ bool Board::pseudolegal(Move move) const
       && !several(state.checkers);
 }
 
+// Legality of pseudolegal move (hash move, killers) - the same
+//  restrictions as generators apply: king doesn't step under
+//  attack, pinned piece stays on the line, en passant is tested
+
+bool Board::legal(Move move) const
+{
+  const SQ from = get_from(move);
+  const SQ to = get_to(move);
+
+  if (is_king(square[from]))
+    return is_castle(move) || !(threats() & bit(to));
+
+  if (is_ep(move))
+    return color ? ep_legal<White>(from) : ep_legal<Black>(from);
+
+  return !!(pin_mask(from) & bit(to));
+}
+
 int Board::best_cap_value() const
 {
   int val = see_value[WP];
@@ -718,7 +813,55 @@ int Board::best_cap_value() const
   return val;
 }
 
-bool Board::make(Move move)
+// Keys of position after the move without making it,
+//  it's for prefetching hash tables while make() works
+
+u64 Board::key_after(Move move, u64 & pk_key) const
+{
+  using namespace Zobrist;
+
+  const SQ from = get_from(move);
+  const SQ to   = get_to(move);
+  const MT mt   = get_mt(move);
+  const Piece p = square[from];
+  const Piece d = square[to];
+  const Castling castling = state.castling - from - to;
+  const SQ ep_sq = mt == PawnMove ? ep_square[from][to] : SQ_N;
+
+  u64 bkey = state.bhash ^ turn ^ key[p][from];
+  pk_key = state.pkhash ^ Zobrist::pk_key[p][from];
+
+  if (d != NOP)
+  {
+    bkey ^= key[d][to];
+    pk_key ^= Zobrist::pk_key[d][to];
+  }
+
+  const Piece moved = is_prom(mt) ? promoted(move, color) : p;
+  bkey ^= key[moved][to];
+  pk_key ^= Zobrist::pk_key[moved][to];
+
+  if (mt == Ep)
+  {
+    const SQ cap = to_sq(file(to), rank(from));
+    bkey ^= key[opp(p)][cap];
+    pk_key ^= Zobrist::pk_key[opp(p)][cap];
+  }
+  else if (mt == KCastle)
+  {
+    const Piece rook = to_piece(Rook, color);
+    bkey ^= key[rook][to + 1] ^ key[rook][to - 1];
+  }
+  else if (mt == QCastle)
+  {
+    const Piece rook = to_piece(Rook, color);
+    bkey ^= key[rook][to - 2] ^ key[rook][to + 1];
+  }
+
+  return bkey ^ castle[(u8)castling] ^ ep[ep_sq];
+}
+
+void Board::make(Move move)
 {
   assert(!is_empty(move));
 
@@ -727,7 +870,9 @@ bool Board::make(Move move)
   const MT mt   = get_mt(move);
   const Piece p = square[from];
 
-  *(state_ptr++) = state;
+  states.push_back(state);
+  keys.push_back(hash());
+  if (Nnue::on) accs.push_back(acc);
 
   state.castling &= uncastle[from] & uncastle[to];
   state.cap = square[to];
@@ -815,7 +960,7 @@ bool Board::make(Move move)
 
   color = ~color;
   state.bhash ^= Zobrist::turn;
-  threefold[moves_cnt++] = hash();
+  moves_cnt++;
 
 #ifdef _DEBUG
   if (hash() != calc_hash())
@@ -827,16 +972,13 @@ bool Board::make(Move move)
   }
 #endif
 
-  if (in_check(1))
-  {
-    unmake(move);
-    return false;
-  }
+  assert(!in_check(1)); // generators are legal
 
-  state.checkers = king_attackers();
-  state.threats = opp_attacks();
+  state.checkers = move_checkers(from, to, mt);
+  state.has_threats = false;
+  state.pinned = pinned();
 
-  return true;
+  assert(state.checkers == king_attackers());
 }
 
 void Board::unmake(Move move)
@@ -912,17 +1054,29 @@ void Board::unmake(Move move)
     }
   }
 
-  state = *(--state_ptr);
+  state = states.back();
+  states.pop_back();
+  keys.pop_back();
+
+  if (Nnue::on)
+  {
+    acc = accs.back();
+    accs.pop_back();
+  }
 }
 
 void Board::make_null()
 {
-  *(state_ptr++) = state;
+  states.push_back(state);
+  keys.push_back(hash());
 
   color = ~color;
   state.ep = SQ_N;
   state.bhash ^= Zobrist::turn;
-  threefold[moves_cnt++] = hash();
+  moves_cnt++;
+
+  state.has_threats = false;
+  state.pinned = pinned();
 }
 
 void Board::unmake_null()
@@ -930,7 +1084,9 @@ void Board::unmake_null()
   color = ~color;
     
   moves_cnt--;
-  state = *(--state_ptr);
+  state = states.back();
+  states.pop_back();
+  keys.pop_back();
 }
 
 }
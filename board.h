@@ -1,12 +1,15 @@
 #pragma once
 #include <string>
+#include <vector>
 #include <cassert>
 #include "consts.h"
+#include "duo.h"
 #include "movelist.h"
 #include "tables.h"
 #include "magics.h"
 #include "zobrist.h"
 #include "material.h"
+#include "nnue.h"
 
 namespace eia {
 
@@ -16,6 +19,11 @@ const int see_value[] =
   1000, 1000, 20000, 20000, 0, 0, 0, 0
 };
 
+// Material and pst of piece on square, white is positive,
+//  filled by Eval::init_psq() of E[0] and summed up in State::psq
+
+extern Duo psq[Piece_N][SQ_N];
+
 struct State
 {
   SQ ep = SQ_N;
@@ -24,9 +32,13 @@ struct State
   int fifty = 0;
   u64 bhash = Empty;
   u64 pkhash = Empty;
+  Duo psq{};
 
   u64 checkers = Empty;
-  u64 threats = Empty;
+  u64 pinned = Empty;
+
+  mutable u64 threats = Empty; // see Board::threats()
+  mutable bool has_threats = false;
 };
 
 struct Undo;
@@ -39,19 +51,23 @@ struct Board
   Piece square[SQ_N];
 
   State state;
-  u64 threefold[8192];
   int moves_cnt;
   MatKey mkey;
 
-  State states[128];
-  State * state_ptr;
+  std::vector<u64> keys;     // hashes of previous positions
+  std::vector<State> states; // for unmake, up to the root
+
+  Nnue::Accumulator acc; // kept only when network is on
+  std::vector<Nnue::Accumulator> accs;
 
 public:
   Board() { clear(); }  
   Board(const Board & board);
+  Board & operator = (const Board & board);
 
   void clear();
   void revert_states();
+  void refresh_acc();
   int phase() const;
   bool is_draw() const;
   bool is_repetition() const;
@@ -59,7 +75,7 @@ public:
 
   inline int ply() const
   {
-    return static_cast<int>(state_ptr - states);
+    return static_cast<int>(states.size());
   }
 
   inline u64 hash() const
@@ -69,7 +85,21 @@ public:
       ^ Zobrist::ep[state.ep];
   }
 
+  // Attacks of opponent are needed mostly for king moves and
+  //  history, so they are computed on the first request only
+
+  inline u64 threats() const
+  {
+    if (!state.has_threats)
+    {
+      state.threats = opp_attacks();
+      state.has_threats = true;
+    }
+    return state.threats;
+  }
+
   u64 calc_hash() const;
+  u64 key_after(Move move, u64 & pk_key) const;
 
   INLINE bool has_pieces(Color col) const
   {
@@ -99,7 +129,7 @@ public:
   INLINE int fifty() const { return state.fifty; }
   INLINE State get_state() const { return state; }
 
-  bool set(std::string fen = Pos::Init);
+  bool set(std::string_view fen = Pos::Init);
   std::string to_fen();
 
   std::string to_string() const;
@@ -110,17 +140,19 @@ public:
   template<PieceType PT>
   INLINE u64  attack(SQ sq, u64 o) const;
 
-  INLINE u64  attack(Piece p, SQ sq) const;
-  INLINE bool is_attacked(SQ sq, u64 o, int opp = 0) const;
+  u64  attack(Piece p, SQ sq) const;
+  bool is_attacked(SQ sq, u64 o, int opp = 0) const;
 
   template<Color COL, bool King = true>
   INLINE u64  get_attackers(u64 o, SQ sq) const;
 
-  INLINE u64  get_all_attackers(u64 o, SQ sq) const;
-  INLINE bool in_check(int opp = 0) const;
-  INLINE bool castling_attacked(SQ from, SQ to) const;
-  INLINE u64  king_attackers(int opp = 0) const;
-  INLINE u64  opp_attacks() const;
+  u64  get_all_attackers(u64 o, SQ sq) const;
+  bool in_check(int opp = 0) const;
+  bool castling_attacked(SQ from, SQ to) const;
+  u64  king_attackers(int opp = 0) const;
+  u64  move_checkers(SQ from, SQ to, MT mt) const;
+  u64  opp_attacks() const;
+  u64  pinned() const;
 
   template<Color COL>
   INLINE u64  king_attrs() const;
@@ -131,10 +163,17 @@ public:
   template<Color COL>
   INLINE u64  discovered(SQ sq) const;
 
+  template<Color COL>
+  INLINE u64  pins() const;
+
+  template<Color COL>
+  INLINE bool ep_legal(SQ from) const;
+
   int see(Move move) const;
   Move recognize(Move move);
-  Move parse_san(std::string str);
+  Move parse_san(std::string_view san);
   bool pseudolegal(Move move) const;
+  bool legal(Move move) const;
   int best_cap_value() const;
 
   INLINE u64 pawns()   const { return piece[BP] | piece[WP]; }
@@ -154,14 +193,14 @@ public:
   template<bool full = true> inline void place(SQ sq, Piece p);
   template<bool full = true> inline void remove(SQ sq);
 
-  bool make(Move move);
+  void make(Move move);
   void unmake(Move move);
 
   void make_null();
   void unmake_null();
 
-  INLINE void generate_all(MoveList & ml) const;
-  void generate_legal(MoveList & ml);
+  void generate_all(MoveList & ml) const;
+  void generate_legal(MoveList & ml) const;
 
   template<Color COL>
   void generate_quiets(MoveList & ml) const;
@@ -209,6 +248,14 @@ private:
     }
     return cap ? occ[~color] : ~occupied();
   }
+
+  // pinned piece on sq may move only along the line of pin
+
+  INLINE u64 pin_mask(SQ sq) const
+  {
+    if (!(state.pinned & bit(sq))) return Full;
+    return line[bitscan(piece[BK ^ color])][sq];
+  }
 };
 
 
@@ -278,7 +325,7 @@ INLINE bool Board::can_castle() const
 
   return (!!(state.castling & castle)    // has rights
       &&   !(occupied() & span[CT])      // no obstruction
-      &&   !(state.threats & path[CT])); // not attacked path
+      &&   !(threats() & path[CT])); // not attacked path
 }
 
 template<PieceType PT>
@@ -392,6 +439,34 @@ INLINE u64 Board::discovered(SQ sq) const
   return bq2 | rq2;
 }
 
+// own pieces pinned to own king
+template<Color Col>
+INLINE u64 Board::pins() const
+{
+  const u64 o = occupied();
+  const SQ king = bitscan(piece[BK ^ Col]);
+
+  u64 pinned = Empty;
+  for (u64 bb = discovered<Col>(king); bb; bb = rlsb(bb))
+  {
+    const u64 ray = between[king][bitscan(bb)] & o;
+    if (ray & occ[Col]) pinned |= ray; // the only blocker
+  }
+  return pinned;
+}
+
+// en passant removes two pawns from the rank at once, so
+//  it is checked by attacks on king after the capture
+template<Color Col>
+INLINE bool Board::ep_legal(SQ from) const
+{
+  const SQ king = bitscan(piece[BK ^ Col]);
+  const SQ cap = to_sq(file(state.ep), rank(from));
+  const u64 o = occupied() ^ bit(from) ^ bit(cap) ^ bit(state.ep);
+
+  return !(get_attackers<~Col, false>(o, king) & ~bit(cap));
+}
+
 template<bool full>
 void Board::place(SQ sq, Piece p)
 {
@@ -405,6 +480,8 @@ void Board::place(SQ sq, Piece p)
   {
     state.bhash ^= Zobrist::key[p][sq];
     state.pkhash ^= Zobrist::pk_key[p][sq];
+    state.psq += psq[p][sq];
+    if (Nnue::on) Nnue::add(acc, p, sq);
   }
 }
 
@@ -424,6 +501,8 @@ void Board::remove(SQ sq)
   {
     state.bhash ^= Zobrist::key[p][sq];
     state.pkhash ^= Zobrist::pk_key[p][sq];
+    state.psq -= psq[p][sq];
+    if (Nnue::on) Nnue::sub(acc, p, sq);
   }
 }
 
@@ -434,7 +513,32 @@ INLINE void Board::gen_lookup(MoveList & ml, u64 mask) const
   constexpr MT type = ATT ? Cap : Quiet;
   constexpr Piece p = to_piece(PT, COL);
 
-  for (u64 bb = piece[p]; bb; bb = rlsb(bb))
+  u64 pieces = piece[p];
+  if constexpr (PT == Knight) pieces &= ~state.pinned; // pinned one can't move
+
+  if constexpr (PT == King) // no steps under attack
+  {
+    const SQ s = bitscan(pieces);
+    const u64 att = attack<King>(s) & mask;
+
+    // Captures are few, they are tested one by one
+    //  to not compute all threats in qsearch leaves
+
+    if (ATT && !state.has_threats)
+    {
+      const u64 o = occupied() ^ bit(s);
+      for (u64 bb = att; bb; bb = rlsb(bb))
+        if (!is_attacked(bitscan(bb), o)) ml.add_move(s, bitscan(bb), type);
+    }
+    else
+    {
+      for (u64 bb = att & ~threats(); bb; bb = rlsb(bb))
+        ml.add_move(s, bitscan(bb), type);
+    }
+    return;
+  }
+
+  for (u64 bb = pieces; bb; bb = rlsb(bb))
   {
     const SQ s = bitscan(bb);
     for (u64 att = attack<PT>(s) & mask; att; att = rlsb(att))
@@ -455,7 +559,7 @@ INLINE void Board::gen_slider(MoveList & ml, u64 mask) const
   for (; bb; bb = rlsb(bb))
   {
     const SQ s = bitscan(bb);
-    for (u64 att = attack<PT>(s) & mask; att; att = rlsb(att))
+    for (u64 att = attack<PT>(s) & mask & pin_mask(s); att; att = rlsb(att))
     {
       ml.add_move(s, bitscan(att), type);
     }
@@ -477,7 +581,7 @@ INLINE void Board::gen_kill_checker(MoveList & ml) const
   const Piece p = BP ^ COL; // own pawn
   const u64 o = occupied();
   const SQ checker = bitscan(state.checkers);
-  const u64 attackers = get_attackers<COL, false>(o, checker);
+  const u64 attackers = get_attackers<COL, false>(o, checker) & ~state.pinned;
   const u64 passers = piece[p] & (COL ? Rank7 : Rank2);
 
   for (u64 bb = attackers & passers; bb; bb = rlsb(bb))
@@ -496,7 +600,8 @@ INLINE void Board::gen_kill_checker(MoveList & ml) const
   {
     for (u64 bb = piece[p] & atts[~p][state.ep]; bb; bb = rlsb(bb))
     {
-      ml.add_move(bitscan(bb), state.ep, Ep);
+      SQ s = bitscan(bb);
+      if (ep_legal<COL>(s)) ml.add_move(s, state.ep, Ep);
     }
   }
 }
@@ -512,7 +617,7 @@ INLINE void Board::gen_pawn_pushes(MoveList & ml, u64 mask) const
     for (u64 bb = pawns & shift_d(mask) & ~Rank7; bb; bb = rlsb(bb))
     {
       SQ s = bitscan(bb);
-      ml.add_move(s, s + 8, PawnMove);
+      if (pin_mask(s) & bit(s + 8)) ml.add_move(s, s + 8, PawnMove);
     }
   }
   else
@@ -520,7 +625,7 @@ INLINE void Board::gen_pawn_pushes(MoveList & ml, u64 mask) const
     for (u64 bb = pawns & shift_u(mask) & ~Rank2; bb; bb = rlsb(bb))
     {
       SQ s = bitscan(bb);
-      ml.add_move(s, s - 8, PawnMove);
+      if (pin_mask(s) & bit(s - 8)) ml.add_move(s, s - 8, PawnMove);
     }
   }
 }
@@ -536,7 +641,7 @@ INLINE void Board::gen_pawn_double(MoveList & ml, u64 mask) const
     for (u64 bb = pawns & (~o >> 8) & (mask >> 16) & Rank2; bb; bb = rlsb(bb))
     {
       SQ s = bitscan(bb);
-      ml.add_move(s, s + 16, PawnMove);
+      if (pin_mask(s) & bit(s + 16)) ml.add_move(s, s + 16, PawnMove);
     }
   }
   else
@@ -544,7 +649,7 @@ INLINE void Board::gen_pawn_double(MoveList & ml, u64 mask) const
     for (u64 bb = pawns & (~o << 8) & (mask << 16) & Rank7; bb; bb = rlsb(bb))
     {
       SQ s = bitscan(bb);
-      ml.add_move(s, s - 16, PawnMove);
+      if (pin_mask(s) & bit(s - 16)) ml.add_move(s, s - 16, PawnMove);
     }
   }
 }
@@ -554,94 +659,97 @@ INLINE void Board::gen_pawn_attacks(MoveList & ml, u64 mask) const
 {
   constexpr Piece p = to_piece(Pawn, COL);
   const u64 o = occupied();
+  const u64 push = ~o & (state.checkers ? check_ray() : Full); // may block
 
   if constexpr (COL)
   {
     // Promotion
-    for (u64 bb = piece[p] & shift_d(~o) & Rank7; bb; bb = rlsb(bb))
+    for (u64 bb = piece[p] & shift_d(push) & Rank7; bb; bb = rlsb(bb))
     {
       SQ s = bitscan(bb);
-      ml.add_prom<QS>(s, s + 8);
+      if (pin_mask(s) & bit(s + 8)) ml.add_prom<QS>(s, s + 8);
     }
 
     // Promotion with capture
     for (u64 bb = piece[p] & shift_dl(mask) & Rank7; bb; bb = rlsb(bb))
     {
       SQ s = bitscan(bb);
-      ml.add_capprom<QS>(s, s + 9);
+      if (pin_mask(s) & bit(s + 9)) ml.add_capprom<QS>(s, s + 9);
     }
 
     // Promotion with capture
     for (u64 bb = piece[p] & shift_dr(mask) & Rank7; bb; bb = rlsb(bb))
     {
       SQ s = bitscan(bb);
-      ml.add_capprom<QS>(s, s + 7);
+      if (pin_mask(s) & bit(s + 7)) ml.add_capprom<QS>(s, s + 7);
     }
 
     // Right pawn capture
     for (u64 bb = piece[p] & shift_dl(mask) & ~Rank7; bb; bb = rlsb(bb))
     {
       SQ s = bitscan(bb);
-      ml.add_move(s, s + 9, Cap);
+      if (pin_mask(s) & bit(s + 9)) ml.add_move(s, s + 9, Cap);
     }
 
     // Left pawn capture
     for (u64 bb = piece[p] & shift_dr(mask) & ~Rank7; bb; bb = rlsb(bb))
     {
       SQ s = bitscan(bb);
-      ml.add_move(s, s + 7, Cap);
+      if (pin_mask(s) & bit(s + 7)) ml.add_move(s, s + 7, Cap);
     }
 
     if (state.ep < SQ_N) // En passant
     {
       for (u64 bb = piece[p] & atts[p ^ 1][state.ep]; bb; bb = rlsb(bb))
       {
-        ml.add_move(bitscan(bb), state.ep, Ep);
+        SQ s = bitscan(bb);
+        if (ep_legal<COL>(s)) ml.add_move(s, state.ep, Ep);
       }
     }
   }
   else
   {
     // Promotion
-    for (u64 bb = piece[p] & shift_u(~o) & Rank2; bb; bb = rlsb(bb))
+    for (u64 bb = piece[p] & shift_u(push) & Rank2; bb; bb = rlsb(bb))
     {
       SQ s = bitscan(bb);
-      ml.add_prom<QS>(s, s - 8);
+      if (pin_mask(s) & bit(s - 8)) ml.add_prom<QS>(s, s - 8);
     }
 
     // Promotion with capture
     for (u64 bb = piece[p] & shift_ur(mask) & Rank2; bb; bb = rlsb(bb))
     {
       SQ s = bitscan(bb);
-      ml.add_capprom<QS>(s, s - 9);
+      if (pin_mask(s) & bit(s - 9)) ml.add_capprom<QS>(s, s - 9);
     }
 
     // Promotion with capture
     for (u64 bb = piece[p] & shift_ul(mask) & Rank2; bb; bb = rlsb(bb))
     {
       SQ s = bitscan(bb);
-      ml.add_capprom<QS>(s, s - 7);
+      if (pin_mask(s) & bit(s - 7)) ml.add_capprom<QS>(s, s - 7);
     }
 
     // Right pawn capture
     for (u64 bb = piece[p] & shift_ur(mask) & ~Rank2; bb; bb = rlsb(bb))
     {
       SQ s = bitscan(bb);
-      ml.add_move(s, s - 9, Cap);
+      if (pin_mask(s) & bit(s - 9)) ml.add_move(s, s - 9, Cap);
     }
 
     // Left pawn capture
     for (u64 bb = piece[p] & shift_ul(mask) & ~Rank2; bb; bb = rlsb(bb))
     {
       SQ s = bitscan(bb);
-      ml.add_move(s, s - 7, Cap);
+      if (pin_mask(s) & bit(s - 7)) ml.add_move(s, s - 7, Cap);
     }
 
     if (state.ep < SQ_N) // En passant
     {
       for (u64 bb = piece[p] & atts[p ^ 1][state.ep]; bb; bb = rlsb(bb))
       {
-        ml.add_move(bitscan(bb), state.ep, Ep);
+        SQ s = bitscan(bb);
+        if (ep_legal<COL>(s)) ml.add_move(s, state.ep, Ep);
       }
     }
   }
@@ -786,8 +894,8 @@ void Board::generate_evasions(MoveList & ml) const
 
   // 1. King evasions (with captures)
 
-  gen_lookup<COL, true, King>(ml, occ[~COL] & ~state.threats);
-  gen_lookup<COL, false, King>(ml, ~occupied() & ~state.threats);
+  gen_lookup<COL, true, King>(ml, occ[~COL] & ~threats());
+  gen_lookup<COL, false, King>(ml, ~occupied() & ~threats());
 
   if (several(state.checkers)) return;
 
@@ -28,11 +28,16 @@ enum Limits
 {
   Plies = 128,
   M0ves = 256,
+  Threads = 256,
 };
 
 enum HashTables
 {
-  Size = 64
+  Size = 64,
+  Max = 1 << 17, // 128 gb
+  PK_Size = 4,   // pawn hash per thread
+  PK_Max = 1024,
+  EV_Size = 2,   // eval cache per thread
 };
 
 namespace Pos
@@ -2,10 +2,19 @@
 #include <iostream>
 #include <format>
 #include <memory>
+#include <random>
+#include <fstream>
+#include <mutex>
+#include <atomic>
 #include "engine.h"
-#include "solver_pvs.h"
+#include "epd.h"
+#include "bench.h"
+#include "perft.h"
+#include "solver_smp.h"
 #include "tuning.h"
+#include "book.h"
 #include "eval.h"
+#include "simd.h"
 
 using namespace std;
 
@@ -13,7 +22,7 @@ namespace eia {
 
 Engine::Engine()
 {
-  S[0] = new SolverPVS();
+  S[0] = new SolverSMP(options.get_int("Threads"));
   S[1] = new Reader();
   cout.sync_with_stdio(false);
   cerr.sync_with_stdio(false);
@@ -22,6 +31,8 @@ Engine::Engine()
 
 Engine::~Engine()
 {
+  stop();
+  wait();
   delete S[1];
   delete S[0];
 }
@@ -42,7 +53,12 @@ void Engine::start()
   while (success)
   {
     std::string str;
-    getline(cin, str);
+    if (!getline(cin, str)) // end of input, nobody will send stop
+    {
+      stop();
+      wait();
+      break;
+    }
     move_start = Clock::now();
 
     if (str.length() > 0)
@@ -67,8 +83,16 @@ bool Engine::parse(string str)
   }
   else if (cmd == "quit")
   {
+    stop();
+    wait();
     return false;
   }
+  else if (cmd == "setoption")
+  {
+    cut(str); // reading out "name"
+    string name = cut(str, " value ");
+    set_option(name, str);
+  }
   else if (cmd == "ucinewgame")
   {
     new_game();
@@ -82,7 +106,7 @@ bool Engine::parse(string str)
     string part = cut(str);
     int depth = parse_int(part);
     if (depth < 1) depth = 1;
-    perft(depth);
+    perft(depth, cut(str) == "fast");
   }
   else if (cmd == "plegt") [[unlikely]]
   {
@@ -95,6 +119,9 @@ bool Engine::parse(string str)
     string op = cut(str);
     if      (op == "checks") test_checks_gen();
     else if (op == "evades") test_evades_gen();
+    else if (op == "simd")   test_simd();
+    else if (op == "nnue")   test_nnue();
+    else if (op == "epd")    test_epd();
     else log("Unknown test '{}'\n", op);
   }
   else if (cmd == "eval") [[unlikely]]
@@ -103,6 +130,10 @@ bool Engine::parse(string str)
     int unused = parse_int(part);
     eval();
   }
+  else if (cmd == "lazy") [[unlikely]]
+  {
+    lazy(cut(str));
+  }
   else if (cmd == "debug") [[unlikely]]
   {
     string part = cut(str);
@@ -148,33 +179,71 @@ bool Engine::parse(string str)
       else if (part == "winc")     cfg.inc[1] = parse_int(cut(str), Time::Inc); 
       else if (part == "binc")     cfg.inc[0] = parse_int(cut(str), Time::Inc); 
       else if (part == "depth")    cfg.depth = parse_int(cut(str), Time::Inc); 
+      else if (part == "nodes")    cfg.nodes = parse_int(cut(str), Val::Inf);
+      else if (part == "movetime") cfg.movetime = parse_int(cut(str), Time::Def);
       else if (part == "infinite") cfg.infinite = true; 
       else break;
     }
     go(cfg);
   }
+  else if (cmd == "bench") [[unlikely]]
+  {
+    int depth = parse_int(cut(str), 12);
+    int hash = parse_int(cut(str), 16);
+    int threads = parse_int(cut(str), 1);
+    bench(depth, hash, threads);
+  }
+  else if (cmd == "train") [[unlikely]]
+  {
+    train();
+  }
+  else if (cmd == "epdtest") [[unlikely]]
+  {
+    string file = cut(str);
+    string limit = cut(str);
+    int value = parse_int(cut(str), limit == "depth" ? 12 : limit == "nodes" ? 1'000'000 : 1000);
+    epdtest(file, limit.empty() ? "movetime" : limit, value, parse_int(cut(str), options.get_int("Threads")));
+  }
+  else if (cmd == "datagen") [[unlikely]]
+  {
+    string file = cut(str);
+    int games = parse_int(cut(str), 1000);
+    string limit = cut(str);
+    int value = parse_int(cut(str), limit == "depth" ? 8 : 5000);
+    int threads = parse_int(cut(str), options.get_int("Threads"));
+    if (limit == "depth") datagen(file, games, value, Val::Inf, threads);
+    else                  datagen(file, games, Val::Inf, value, threads);
+  }
   else if (cmd == "tunek") [[unlikely]]
   {
     string file = cut(str);
     string batch = cut(str);
-    tunek(file, parse_int(batch, 0));
+    tunek(file, parse_int(batch, 0), parse_int(cut(str), options.get_int("TunerThreads")));
   }
   else if (cmd == "spsa") [[unlikely]]
   {
     string file = cut(str);
     string batch = cut(str);
-    spsa(file, parse_int(batch, 100'000));
+    spsa(file, parse_int(batch, 100'000), parse_int(cut(str), options.get_int("TunerThreads")));
   }
   else if (cmd == "agrd") [[unlikely]]
   {
     string file = cut(str);
-    agrd(file);
+    string batch = cut(str);
+    agrd(file, parse_int(batch, 0), parse_int(cut(str), options.get_int("TunerThreads")));
+  }
+  else if (cmd == "adam" || cmd == "adamw") [[unlikely]]
+  {
+    string file = cut(str);
+    string batch = cut(str);
+    const double decay = cmd == "adamw" ? 1e-4 : 0.;
+    adam(file, parse_int(batch, 16'384), decay, parse_int(cut(str), options.get_int("TunerThreads")));
   }
   else if (cmd == "tune") [[unlikely]]
   {
     string file = cut(str);
     string batch = cut(str);
-    tune(file, parse_int(batch, 100'000));
+    tune(file, parse_int(batch, 100'000), parse_int(cut(str), options.get_int("TunerThreads")));
   }
   else
   {
@@ -186,6 +255,8 @@ bool Engine::parse(string str)
 
 void Engine::new_game()
 {
+  stop();
+  wait();
   B.set();
   S[0]->set(B);
   S[1]->set(B);
@@ -193,14 +264,91 @@ void Engine::new_game()
   S[1]->new_game();
 }
 
+void Engine::set_option(string name, string val)
+{
+  stop();
+  wait();
+  options.set(name, val);
+
+  if (name == "Threads")
+  {
+    S[0]->set_threads(options.get_int(name));
+    print_info(format("threads {}", options.get_int(name)));
+  }
+  else if (name == "Hash")
+  {
+    const MB size = options.get_int(name);
+    S[0]->set_hash(size);
+    if (S[0]->get_hash_mb() < size)
+      print_info(format("not enough memory for hash {} mb", size));
+    print_info(format("hash {} mb", S[0]->get_hash_mb()));
+  }
+  else if (name == "PawnHash")
+  {
+    S[0]->set_pk_hash(options.get_int(name));
+    print_info(format("pawn hash {} mb per thread", options.get_int(name)));
+  }
+  else if (name == "LazyEval")
+  {
+    Eval::lazy = options.get_int(name);
+    print_info(format("lazy eval {}", Eval::lazy ? "on" : "off"));
+  }
+  else if (name == "EvalFile")
+  {
+    const string file = options.get_val(name);
+    if (Nnue::load(file)) print_info(format("network {} is loaded", file));
+    else print_info(format("can't load network {}", file));
+    set_nnue(options.get_int("UseNNUE"));
+  }
+  else if (name == "UseNNUE")
+  {
+    set_nnue(options.get_int(name));
+  }
+}
+
+// Tables keep evals of the other evaluator, so they are
+//  cleared as for a new game
+
+void Engine::set_nnue(bool val)
+{
+  if (val && !Nnue::net)
+    print_info("no network, set EvalFile first");
+
+  Nnue::on = val && Nnue::net;
+  B.refresh_acc();
+  new_game();
+  print_info(format("eval {}", Nnue::on ? "nnue " + Nnue::file_name() : "hce"));
+}
+
 void Engine::stop()
 {
   S[0]->stop();
   S[1]->stop();
 }
 
-void Engine::perft(int depth)
+// Search is running in its own thread while the main one keeps
+//  reading commands, so this is the only place they meet
+
+void Engine::wait()
 {
+  if (searcher.joinable()) searcher.join();
+}
+
+void Engine::perft(int depth, bool fast)
+{
+  wait();
+  if (fast)
+  {
+    Perft perft(options.get_int("Hash"));
+    if (!perft.ok())
+    {
+      say("Not enough memory for perft table\n");
+      return;
+    }
+    perft.run(B, depth, options.get_int("Threads"));
+    return;
+  }
+
   S[0]->set(B);
   S[1]->set(B);
   S[0]->perft(depth);
@@ -209,6 +357,7 @@ void Engine::perft(int depth)
 
 void Engine::plegt()
 {
+  wait();
   S[0]->set(B);
   S[1]->set(B);
   S[0]->plegt();
@@ -264,8 +413,198 @@ void Engine::test_evades_gen()
   if (success) log("Test generator is correct\n");
 }
 
+// Vector eval kernels have to give the same evals as scalar
+//  one, compared over bench positions and their 2-ply subtrees
+
+void Engine::test_simd()
+{
+  wait();
+  vector<Board> boards;
+
+  auto expand = [&](Board & board, int depth, auto & self) -> void
+  {
+    boards.push_back(board);
+    if (depth <= 0) return;
+
+    MoveList ml;
+    board.generate_legal(ml);
+    while (!ml.empty())
+    {
+      const Move move = ml.get_next();
+      board.make(move);
+      self(board, depth - 1, self);
+      board.unmake(move);
+    }
+  };
+
+  for (const auto & fen : Bench_Fens)
+  {
+    Board board;
+    board.set(fen);
+    expand(board, 2, expand);
+  }
+
+  auto evals = [&]()
+  {
+    vector<Val> vals;
+    for (const Board & board : boards)
+      vals.push_back(E->eval(&board, -Val::Inf, Val::Inf, false));
+    return vals;
+  };
+
+  // Tuner kernel sums floats in other order, so it has
+  //  to agree up to rounding on random sparse vectors
+
+  mt19937 gen(1);
+  vector<float> w(2 * Param_N), val(Param_N);
+  vector<i32> idx(Param_N);
+  for (auto & x : w)   x = uniform_real_distribution<float>(-100.f, 100.f)(gen);
+  for (auto & x : val) x = uniform_real_distribution<float>(-2.f, 2.f)(gen);
+  for (auto & x : idx) x = uniform_int_distribution<i32>(0, Param_N - 1)(gen);
+
+  auto sparse = [&]()
+  {
+    vector<Simd::OpEg> sums;
+    for (int n = 0; n < 200; n++)
+      sums.push_back(Simd::sparse_dot(w.data(), idx.data() + n, val.data() + n, n));
+    return sums;
+  };
+
+  const Simd::Level active = Simd::level();
+  Simd::set_level(Simd::Level::Scalar);
+  const vector<Val> expected = evals();
+  const vector<Simd::OpEg> expected_sums = sparse();
+
+  log("-- SIMD kernels over {} positions, active {}\n", boards.size(), Simd::to_string(active));
+  for (auto lvl : {Simd::Level::AVX2, Simd::Level::AVX512})
+  {
+    if (!Simd::set_level(lvl))
+    {
+      log("{}: not supported\n", Simd::to_string(lvl));
+      continue;
+    }
+
+    const vector<Val> vals = evals();
+    size_t errors = 0;
+    for (size_t i = 0; i < vals.size(); i++)
+    {
+      if (vals[i] == expected[i]) continue;
+      if (errors++ < 5)
+        log("{}: {} instead of {} for {}\n", Simd::to_string(lvl), vals[i], expected[i], boards[i].to_fen());
+    }
+    const vector<Simd::OpEg> sums = sparse();
+    for (size_t i = 0; i < sums.size(); i++)
+    {
+      const auto close = [](float a, float b) { return abs(a - b) <= 1e-4f * (1.f + abs(b)); };
+      if (!close(sums[i].op, expected_sums[i].op) || !close(sums[i].eg, expected_sums[i].eg))
+        if (errors++ < 5) log("{}: sparse sum of {} differs\n", Simd::to_string(lvl), i);
+    }
+
+    log("{}: {}\n", Simd::to_string(lvl), errors ? format("{} mismatches", errors) : "ok");
+  }
+
+  Simd::set_level(active);
+}
+
+// Accumulators updated in make/unmake have to be the same as
+//  computed from scratch, checked over bench subtrees
+
+void Engine::test_nnue()
+{
+  wait();
+  if (!Nnue::on)
+  {
+    log("Network is off\n");
+    return;
+  }
+
+  u64 count = 0, errors = 0;
+  auto check = [&](const Board & board)
+  {
+    Nnue::Accumulator fresh;
+    Nnue::refresh(fresh, board.square);
+    count++;
+    if (board.acc != fresh && errors++ < 5)
+      log("Accumulator differs after {}\n", board.to_string());
+  };
+
+  auto expand = [&](Board & board, int depth, auto & self) -> void
+  {
+    check(board);
+    if (depth <= 0) return;
+
+    MoveList ml;
+    board.generate_legal(ml);
+    while (!ml.empty())
+    {
+      const Move move = ml.get_next();
+      board.make(move);
+      self(board, depth - 1, self);
+      board.unmake(move);
+      check(board);
+    }
+  };
+
+  for (const auto & fen : Bench_Fens)
+  {
+    Board board;
+    board.set(fen);
+    expand(board, 3, expand);
+  }
+
+  log("-- NNUE accumulators over {} positions: {}\n", count,
+    errors ? format("{} mismatches", errors) : "ok");
+}
+
+void Engine::test_epd()
+{
+  struct Case
+  {
+    string_view line;
+    bool valid;
+    string_view fen, best;
+    u64 perft[2];
+  };
+
+  const Case cases[] =
+  {
+    {"", false, "", "", {}},
+    {"  \t ", false, "", "", {}},
+    {"8/8/8/8/8/8/8/K6k w", false, "", "", {}},
+    {"8/8/8/8/8/8/8/K6k w - -", true, "8/8/8/8/8/8/8/K6k w - -", "", {}},
+    {"8/8/8/8/8/8/8/K6k w - - ;", true, "8/8/8/8/8/8/8/K6k w - -", "", {}},
+    {"2rr3k/pp3pp1/1nnqbN1p/3pN3/2pP4/2P3Q1/PPB4P/R3R1K1 w - - bm Qg6; id \"WAC.001\";",
+      true, "2rr3k/pp3pp1/1nnqbN1p/3pN3/2pP4/2P3Q1/PPB4P/R3R1K1 w - -", "g3g6", {}},
+    {"4k3/P7/8/8/8/8/8/4K3 w - - bm a8=Q;",
+      true, "4k3/P7/8/8/8/8/8/4K3 w - -", "a7a8q", {}},
+    {"rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq - D1 20; D2 400;",
+      true, "rnbqkbnr/pppppppp/8/8/8/8/PPPPPPPP/RNBQKBNR w KQkq -", "", {20, 400}}
+  };
+
+  int errors = 0;
+  Problem problem;
+  Board board;
+  for (const auto & c : cases)
+  {
+    Epd::parse(c.line, problem, board);
+    bool ok = problem.valid == c.valid;
+    if (ok && c.valid)
+    {
+      ok = problem.fen == c.fen
+        && problem.perft[1] == c.perft[0] && problem.perft[2] == c.perft[1]
+        && problem.best.size() == (c.best.empty() ? 0u : 1u)
+        && (c.best.empty() || to_string(problem.best.begin()->first) == c.best);
+    }
+    if (!ok && errors++ < 5) log("Wrong parse of \"{}\"\n", c.line);
+  }
+
+  log("-- EPD parsing over {} lines: {}\n", std::size(cases),
+    errors ? format("{} mismatches", errors) : "ok");
+}
+
 void Engine::eval()
 {
+  wait();
   Val val = E->eval(&B, -Val::Inf, Val::Inf, false);
   string str = format("Eval: {}\n\n", val);
 
@@ -290,6 +629,72 @@ void Engine::eval()
   say<1>("{}", str);
 }
 
+// Distribution of terms left out by lazy eval (full eval minus the
+//  estimate) over positions of epd file, or over bench positions
+//  with all their children up to two plies - to set Lazy_Margin
+
+void Engine::lazy(string file)
+{
+  wait();
+  vector<int> diffs;
+
+  auto sample = [&](const Board & board)
+  {
+    if (board.state.checkers) return; // no stand pat in check
+
+    const Val full = E->eval(&board, -Val::Inf, Val::Inf, false);
+    if (decisive(full)) return;
+
+    diffs.push_back(abs(dry(full - E->estimate(&board))));
+  };
+
+  auto expand = [&](Board & board, int depth, auto & self) -> void
+  {
+    sample(board);
+    if (depth <= 0) return;
+
+    MoveList ml;
+    board.generate_legal(ml);
+    while (!ml.empty())
+    {
+      const Move move = ml.get_next();
+      board.make(move);
+      self(board, depth - 1, self);
+      board.unmake(move);
+    }
+  };
+
+  if (file.empty())
+  {
+    for (const auto & fen : Bench_Fens)
+    {
+      Board board;
+      board.set(fen);
+      expand(board, 2, expand);
+    }
+  }
+  else
+  {
+    Epd::scan(file, [&](const Problem & problem)
+    {
+      Board board;
+      if (problem.valid && board.set(problem.fen)) sample(board);
+    });
+  }
+
+  if (diffs.empty()) return;
+  sort(diffs.begin(), diffs.end());
+
+  const size_t n = diffs.size();
+  const auto over = ranges::count_if(diffs, [](int d) { return cp(d) > Lazy_Margin; });
+
+  say<1>("-- Lazy eval margin over {} positions\n", n);
+  for (double q : {0.5, 0.9, 0.99, 0.995, 0.999})
+    say<1>("{:5.1f}% within {} cp\n", 100 * q, diffs[static_cast<size_t>(q * (n - 1))]);
+  say<1>("  max: {} cp\n", diffs.back());
+  say<1>("Lazy_Margin {} cp is exceeded in {:.2f}% of positions\n\n", dry(Lazy_Margin), 100.0 * over / n);
+}
+
 void Engine::set_debug(bool val)
 {
   options.flag_debug = val;
@@ -316,35 +721,422 @@ bool Engine::do_move(Move mv)
   Move move = B.recognize(mv);
   if (move == Move::None) return false;
 
-  bool success = B.make(move);
+  B.make(move);
   B.revert_states();
 
-  return success;
+  return true;
 }
 
 void Engine::go(const SearchCfg & cfg)
 {
+  stop(); // previous one may be infinite
+  wait();
   for (auto solver : S)
   {
     solver->set(B);
-    solver->get_move(move_start, cfg);
+    solver->start_thinking();
+  }
+
+  searcher = thread([this, cfg, start = move_start]()
+  {
+    for (auto solver : S)
+      solver->get_move(start, cfg);
+  });
+}
+
+// Fixed depth search over embedded positions with cleared tables,
+//  node count (and signature) change only if the search changes,
+//  that holds for one thread - more threads aren't deterministic
+
+void Engine::bench(int depth, MB hash, int threads)
+{
+  say<1>("-- Bench depth {} hash {} threads {}\n", depth, hash, threads);
+
+  wait();
+  S[0]->set_hash(hash);
+  S[0]->set_threads(threads);
+  S[0]->set_verbosity(false);
+
+  SearchCfg cfg;
+  cfg.depth = depth;
+  cfg.infinite = true; // no time limits
+
+  const int count = static_cast<int>(std::size(Bench_Fens));
+  const u64 pk_probes = S[0]->get_pk_probes();
+  const u64 pk_hits = S[0]->get_pk_hits();
+  u64 nodes = 0ull;
+  u64 sign = 0xCBF29CE484222325ull; // FNV-1a
+  MS time = 0;
+
+  for (int i = 0; i < count; i++)
+  {
+    B.set(Bench_Fens[i]);
+    S[0]->set(B);
+    S[0]->new_game();
+
+    Timestamp start = Clock::now();
+    S[0]->start_thinking();
+    Move best = S[0]->get_move(start, cfg);
+    time += elapsed(start);
+
+    const u64 cnt = S[0]->get_nodes();
+    nodes += cnt;
+    sign = (sign ^ cnt) * 0x100000001B3ull;
+
+    say<1>("{:>2}/{} {:<5} {:>10} nodes\n", i + 1, count, best, cnt);
   }
+
+  say<1>("\nNodes: {}\n", nodes);
+  say<1>("Time: {} ms\n", time);
+  say<1>("NPS: {}\n", 1000 * nodes / (time + 1));
+  say<1>("Pawn hash: {} mb, {:.1f}% hits\n", options.get_int("PawnHash"),
+    100.0 * (S[0]->get_pk_hits() - pk_hits) / (S[0]->get_pk_probes() - pk_probes + 1));
+  say<1>("Signature: {:016X}\n\n", sign);
+
+  S[0]->set_verbosity(true);
+  S[0]->set_threads(options.get_int("Threads"));
+  S[0]->set_hash(options.get_int("Hash"));
+  new_game();
+}
+
+// Fixed workload for the training run of profile guided build,
+//  it should cover search, eval and move generation as the real
+//  games do, so bench goes together with a couple of perfts
+
+void Engine::train()
+{
+  say<1>("-- Training workload\n");
+
+  bench(11, 16, 1);
+
+  const pair<string, int> perfts[] =
+  {
+    { Pos::Init, 5 },
+    { Bench_Fens[1], 4 },
+    { Bench_Fens[2], 5 },
+  };
+
+  for (auto & [fen, depth] : perfts)
+  {
+    B.set(fen);
+    perft(depth);
+  }
+  new_game();
+}
+
+// Test suite in EPD, problems are solved in parallel with solver
+//  per thread. Found move is scored by bm/am or STS points (c8, c9),
+//  time to solution is the one of the iteration since which the
+//  move stays right, D1..D9 perft counts are checked too
+
+void Engine::epdtest(string file, string limit, int value, int threads)
+{
+  say<1>("-- EPD test {}, {} {}, {} threads\n", file, limit, value, threads);
+
+  wait();
+
+  // Problems are solved in parallel, so they are all kept with
+  //  own copies of text the views of scan() point to
+
+  struct Task
+  {
+    Problem problem;
+    string fen, id;
+    int line;
+  };
+
+  vector<Task> problems;
+  int line = 0;
+  const bool read = Epd::scan(file, [&](const Problem & p)
+  {
+    line++;
+    if (!p.valid) return;
+
+    Task & task = problems.emplace_back(p, string(p.fen), string(p.id), line);
+    task.problem.fen = task.problem.id = {}; // not to dangle
+  });
+  if (!read) return;
+
+  SearchCfg cfg;
+  if      (limit == "depth") cfg.depth = value, cfg.infinite = true;
+  else if (limit == "nodes") cfg.nodes = value, cfg.infinite = true;
+  else                       cfg.movetime = value;
+
+  struct Outcome
+  {
+    bool tried = false, solved = false;
+    Move move = Move::None;
+    int score = 0, max_score = 0;
+    MS time = 0; // to solution
+    u64 nodes = 0ull;
+    string perft; // failed depths
+    int perft_n = 0;
+  };
+
+  vector<Outcome> outcomes(problems.size());
+  atomic<size_t> next = 0;
+  Perft perft(64);
+  const Timestamp start = Clock::now();
+
+  auto solve = [&]()
+  {
+    auto S = make_unique<SolverPVS>();
+    S->set_verbosity(false);
+    Board B;
+
+    for (size_t i = next++; i < problems.size(); i = next++)
+    {
+      const Problem & p = problems[i].problem;
+      Outcome & out = outcomes[i];
+
+      B.set(problems[i].fen);
+      for (int depth = 1; depth < 10; depth++)
+      {
+        if (!p.perft[depth]) continue;
+
+        out.perft_n++;
+        const u64 cnt = perft.leaves(B, depth);
+        if (cnt != p.perft[depth])
+          out.perft += format(" D{} {} != {}", depth, cnt, p.perft[depth]);
+      }
+
+      if (p.best.empty() && p.avoid == Move::None) continue;
+
+      for (auto & [move, score] : p.best)
+        out.max_score = (std::max)(out.max_score, score);
+
+      auto right = [&](Move move)
+      {
+        if (move == p.avoid) return false;
+        if (p.best.empty()) return true;
+
+        auto it = p.best.find(move);
+        return it != p.best.end() && it->second == out.max_score;
+      };
+
+      S->set(B);
+      S->new_game();
+      S->start_thinking();
+      out.move = S->get_move(Clock::now(), cfg);
+      out.nodes = S->get_nodes();
+      out.tried = true;
+      out.solved = right(out.move);
+
+      auto it = p.best.find(out.move);
+      out.score = it != p.best.end() ? it->second : 0;
+
+      const auto & iters = S->get_iters();
+      for (auto iter = iters.rbegin(); iter != iters.rend() && right(iter->best); ++iter)
+        out.time = iter->time;
+    }
+  };
+
+  vector<thread> workers;
+  for (int i = 0; i < (std::max)(threads, 1); i++)
+    workers.emplace_back(solve);
+
+  for (auto & worker : workers) worker.join();
+  const MS time = elapsed(start);
+
+  int tried = 0, solved = 0, score = 0, max_score = 0;
+  int perft_n = 0, perft_failed = 0;
+  u64 nodes = 0ull;
+  vector<MS> times;
+
+  for (size_t i = 0; i < problems.size(); i++)
+  {
+    const Outcome & out = outcomes[i];
+    const string & id = problems[i].id;
+    const int line = problems[i].line;
+
+    perft_n += out.perft_n;
+    perft_failed += !out.perft.empty();
+    if (!out.perft.empty())
+      say<1>("{:>4} {:<24} perft failed:{}\n", line, id, out.perft);
+
+    if (!out.tried) continue;
+
+    tried++;
+    score += out.score;
+    max_score += out.max_score;
+    nodes += out.nodes;
+    if (out.solved)
+    {
+      solved++;
+      times.push_back(out.time);
+    }
+
+    say<1>("{:>4} {:<24} {:<6} {} {:>7} ms {:>3}\n", line, id, out.move,
+      out.solved ? "+" : "-", out.solved ? out.time : 0, out.score);
+  }
+
+  std::sort(times.begin(), times.end());
+  auto percentile = [&](int pct) -> MS
+  {
+    if (times.empty()) return 0;
+    const size_t n = (times.size() * pct + 99) / 100; // nearest rank
+    return times[(std::max)(n, size_t(1)) - 1];
+  };
+
+  say<1>("\nSolved: {}/{} ({:.1f}%)\n", solved, tried, 100.0 * solved / (tried + !tried));
+  if (max_score) say<1>("Score: {}/{} ({:.1f}%)\n", score, max_score, 100.0 * score / max_score);
+  say<1>("Time to solution: 50% {} ms, 90% {} ms, 100% {} ms\n",
+    percentile(50), percentile(90), percentile(100));
+  if (perft_n) say<1>("Perft: {} counts checked, {} problems failed\n", perft_n, perft_failed);
+  say<1>("Nodes: {}\n", nodes);
+  say<1>("Time: {} ms\n", time);
+  say<1>("NPS: {}\n\n", 1000 * nodes / (time + 1));
+}
+
+// Self-play games for tuning datasets, every thread plays its own
+//  games with independent solver from random book openings, quiet
+//  positions go to csv "fen;score;result" read by tuners (white's
+//  point of view, score in cp, result is -1, 0 or 1)
+
+void Engine::datagen(string file, int games, int depth, int nodes, int threads)
+{
+  const int Random_Plies = 8;  // when there is no book
+  const int Max_Plies = 400;   // then it's a draw
+  const Val Win_Bound = 1500_cp;
+  const int Win_Plies = 6;     // in a row to adjudicate
+
+  say<1>("-- Datagen {} games, {} {}, {} threads\n", games,
+    depth != Val::Inf ? "depth" : "nodes", depth != Val::Inf ? depth : nodes, threads);
+
+  wait();
+  ofstream fout(file, ios::app);
+  if (!fout.is_open())
+  {
+    say<1>("Can't open \"{}\"\n", file);
+    return;
+  }
+
+  Book book;
+  if (!BookReader(&book).read_pgn(Tunes::Book))
+    say<1>("Openings are {} random plies\n", Random_Plies);
+
+  SearchCfg cfg;
+  cfg.depth = depth;
+  cfg.nodes = nodes;
+  cfg.infinite = true; // no time limits
+
+  mutex lock; // book and file
+  atomic<int> next_game = 0;
+  u64 positions = 0ull;
+  int played = 0;
+  const Timestamp start = Clock::now();
+  MS reported = 0;
+
+  auto play = [&](int id)
+  {
+    auto S = make_unique<SolverPVS>();
+    S->set_verbosity(false);
+    mt19937 gen(random_device{}() + id);
+    Board B;
+
+    struct Record { string fen; int score; };
+    vector<Record> records;
+
+    while (next_game++ < games)
+    {
+      B.set(Pos::Init);
+      S->new_game();
+      records.clear();
+
+      Moves line;
+      {
+        lock_guard<mutex> guard(lock);
+        line = book.get_random_line();
+      }
+      for (Move move : line) B.make(move);
+
+      for (int i = 0; line.empty() && i < Random_Plies; i++)
+      {
+        MoveList ml;
+        B.generate_legal(ml);
+        if (ml.empty()) break;
+
+        const int n = uniform_int_distribution<int>(0, (int)ml.count() - 1)(gen);
+        for (int j = 0; j < n; j++) ml.get_next();
+        B.make(ml.get_next());
+      }
+
+      int result = 0, win_plies = 0;
+      for (int ply = 0; ply < Max_Plies; ply++)
+      {
+        MoveList ml;
+        B.generate_legal(ml);
+        if (ml.empty())
+        {
+          if (B.state.checkers) result = B.color ? -1 : 1;
+          break;
+        }
+        if (B.is_draw()) break;
+
+        S->set(B);
+        S->start_thinking();
+        const Move best = S->get_move(Clock::now(), cfg);
+        const Val val = S->get_root_val();
+        const int white = B.color ? 1 : -1;
+
+        if (S->get_root_depth() > 0
+        &&  !B.state.checkers
+        &&  !is_attack(best)
+        &&  !decisive(val))
+          records.push_back({ B.to_fen(), white * dry(val) });
+
+        win_plies = abs(val) >= Win_Bound ? win_plies + 1 : 0;
+        if (win_plies >= Win_Plies)
+        {
+          result = val > 0 ? white : -white;
+          break;
+        }
+
+        B.make(best);
+      }
+
+      lock_guard<mutex> guard(lock);
+      for (auto & [fen, score] : records)
+        fout << format("{};{};{}\n", fen, score, result);
+
+      positions += records.size();
+      played++;
+
+      const MS time = elapsed(start);
+      if (time - reported >= 10'000 || played == games)
+      {
+        reported = time;
+        say<1>("{} games, {} positions, {} pos/s\n",
+          played, positions, 1000 * positions / (time + 1));
+      }
+    }
+  };
+
+  vector<thread> workers;
+  for (int i = 0; i < (std::max)(threads, 1); i++)
+    workers.emplace_back(play, i);
+
+  for (auto & worker : workers) worker.join();
+  say<1>("Done in {} ms\n\n", elapsed(start));
 }
 
 // Tuning of K constant which occurs in sigmoid function
 //  on dataset while estimating positions evaluations
 
-void Engine::tunek(std::string file, int batch_sz)
+void Engine::tunek([[maybe_unused]] std::string file, [[maybe_unused]] int batch_sz,
+                   [[maybe_unused]] int threads)
 {
   say<1>("-- Tuning K constant\n");
 
 #ifdef TUNING
   auto loss = make_unique<MSE>();
   auto tuner = make_unique<TunerCached>(std::move(loss));
+  tuner->set_threads(threads);
   tuner->open(file);
 
   log("Positions: {}\n", tuner->size());
-  log("Batch size: {}\n\n", tuner->batch_n());
+  log("Batch size: {}\n", tuner->batch_n());
+  log("Threads: {}\n\n", tuner->get_threads());
 
   const auto v = E->to_tune();
   double k = find_k(std::move(tuner), v, 0., 1.);
@@ -358,18 +1150,21 @@ void Engine::tunek(std::string file, int batch_sz)
 // Simultaneous Perturbation Stochastic Approximation (SPSA)
 // For statically generated dataset of pairs fen-result
 
-void Engine::spsa(string file, int batch_sz)
+void Engine::spsa([[maybe_unused]] string file, [[maybe_unused]] int batch_sz,
+                  [[maybe_unused]] int threads)
 {
   say<1>("-- SPSA tuning\n");
 
 #ifdef TUNING
   auto loss = make_unique<MSE>();
   auto tuner = make_unique<TunerStatic>(std::move(loss), batch_sz);
+  tuner->set_threads(threads);
 
   tuner->open(file);
 
   log("Positions: {}\n\n", tuner->size());
-  log("Batch size: {}\n\n", tuner->batch_n());
+  log("Batch size: {}\n", tuner->batch_n());
+  log("Threads: {}\n\n", tuner->get_threads());
 
   SPSA optimizator(std::move(tuner), 5'000'000, 1, .1, 100);
   optimizator.start();
@@ -381,13 +1176,15 @@ void Engine::spsa(string file, int batch_sz)
 // Adaptive Gradient (AdaGrad)
 // Its adaptive learning rates accelerate convergence
 
-void Engine::agrd(string file)
+void Engine::agrd([[maybe_unused]] string file, [[maybe_unused]] int batch_sz,
+                  [[maybe_unused]] int threads)
 {
   say<1>("-- AdaGrad tuning\n");
 
 #ifdef TUNING
   auto loss = make_unique<MSE>();
-  auto tuner = make_unique<TunerCached>(std::move(loss));
+  auto tuner = make_unique<TunerCached>(std::move(loss), batch_sz, .05);
+  tuner->set_threads(threads);
 
   if (!tuner->open(file))
   {
@@ -395,8 +1192,9 @@ void Engine::agrd(string file)
     return;
   }
 
-  log("Positions: {}\n", tuner->size());
-  log("Batch size: {}\n\n", tuner->batch_n());
+  log("Positions: {} ({} held out)\n", tuner->size(), tuner->size() - tuner->train_n());
+  log("Batch size: {}\n", tuner->batch_n());
+  log("Threads: {}\n\n", tuner->get_threads());
   
   AdaGrad optimizator(std::move(tuner), 10);
   optimizator.start();
@@ -405,15 +1203,47 @@ void Engine::agrd(string file)
 #endif
 }
 
+// Adaptive Moment Estimation (Adam), AdamW with weight decay
+// Shuffled mini-batches, validated on held-out positions
+
+void Engine::adam([[maybe_unused]] string file, [[maybe_unused]] int batch_sz,
+                  [[maybe_unused]] double decay, [[maybe_unused]] int threads)
+{
+  say<1>("-- Adam tuning\n");
+
+#ifdef TUNING
+  auto loss = make_unique<MSE>();
+  auto tuner = make_unique<TunerCached>(std::move(loss), batch_sz, .05);
+  tuner->set_threads(threads);
+
+  if (!tuner->open(file))
+  {
+    log("File opening failed!\n");
+    return;
+  }
+
+  log("Positions: {} ({} held out)\n", tuner->size(), tuner->size() - tuner->train_n());
+  log("Batch size: {}\n", tuner->batch_n());
+  log("Threads: {}\n\n", tuner->get_threads());
+
+  Adam optimizator(std::move(tuner), .5, decay);
+  optimizator.start();
+#else
+  log("Available in profile 'Tuning'\n");
+#endif
+}
+
 // External tune function for use in python
 
-void Engine::tune(std::string file, int batch_sz)
+void Engine::tune([[maybe_unused]] std::string file, [[maybe_unused]] int batch_sz,
+                  [[maybe_unused]] int threads)
 {
   say<1>("-- Tune mode\n");
 
 #ifdef TUNING
   auto loss = make_unique<MSE>();
   auto tuner = make_unique<TunerStatic>(std::move(loss), batch_sz);
+  tuner->set_threads(threads);
 
   tuner->open(file);
 
@@ -1,4 +1,5 @@
 #pragma once
+#include <thread>
 #include "options.h"
 #include "solver.h"
 #include "board.h"
@@ -12,6 +13,7 @@ class Engine
   Options options;
   Solver * S[2];
   Board B;
+  std::thread searcher;
 
 public:
   Engine();
@@ -23,21 +25,33 @@ public:
 
   // commands
   void new_game();
+  void set_option(std::string name, std::string val);
   void stop();
-  void perft(int depth = 1);
+  void wait();
+  void perft(int depth = 1, bool fast = false);
   void plegt();
   void test_checks_gen();
   void test_evades_gen();
+  void test_simd();
+  void test_nnue();
+  void test_epd();
   void evalt(int depth = 6);
   void eval();
+  void lazy(std::string file);
   void set_debug(bool val);
+  void set_nnue(bool val);
   void set_pos(std::string fen, std::vector<Move> moves);
   bool do_move(Move mv);
   void go(const SearchCfg & cfg);
-  void tunek(std::string file, int batch_sz = 0);
-  void spsa(std::string file, int batch_sz = 100'000);
-  void agrd(std::string file);
-  void tune(std::string file, int batch_sz = 100'000); // for external use
+  void bench(int depth = 12, MB hash = 16, int threads = 1);
+  void train();
+  void epdtest(std::string file, std::string limit, int value, int threads = 1);
+  void datagen(std::string file, int games, int depth, int nodes, int threads = 1);
+  void tunek(std::string file, int batch_sz = 0, int threads = 0);
+  void spsa(std::string file, int batch_sz = 100'000, int threads = 0);
+  void agrd(std::string file, int batch_sz = 0, int threads = 0);
+  void adam(std::string file, int batch_sz = 16'384, double decay = 0., int threads = 0);
+  void tune(std::string file, int batch_sz = 100'000, int threads = 0); // for external use
 };
 
 }
@@ -1,78 +1,111 @@
 #include <fstream>
+#include <algorithm>
 #include "epd.h"
 
 using namespace std;
 
 namespace eia {
 
-bool Epd::read(std::string file)
+bool Epd::scan(std::string file, const Callback & fn)
 {
-  ifstream fin(file);
-  if (!fin.is_open())
+  LineReader reader;
+  if (!reader.open(file))
   {
     say("Can't open \"{}\" as epd\n", file);
     return false;
   }
 
-  for (string line; getline(fin, line);)
+  Problem problem;
+  Board B;
+
+  for (std::string_view line; reader.next(line);)
   {
-    Problem problem = parse_problem(line);
-    problems.push_back(problem);
+    parse(line, problem, B);
+    fn(problem);
   }
   return true;
 }
 
-Problem Epd::parse_problem(std::string str)
+// Fen goes to board straight from the line, text fields
+//  of the problem are views of it and nothing is copied
+
+void Epd::parse(std::string_view str, Problem & problem, Board & B)
 {
-  Problem problem;
-  Board B;
+  problem.valid = false;
+  problem.id = {};
+  for (auto & comment : problem.comment) comment = {};
+  problem.best.clear();
+  problem.avoid = Move::None;
+  std::fill(std::begin(problem.perft), std::end(problem.perft), 0ull);
+
+  // Fen is 4 fields, blank lines and shorter ones are skipped
 
-  for (int i = 0; i < 4; ++i) problem.fen += cut(str) + " ";
-  if (!B.set(problem.fen)) return problem;
+  const size_t first = str.find_first_not_of(" \t");
+  if (first == std::string_view::npos) return;
+  str.remove_prefix(first);
 
-  auto ops = split(str, "; ");
-  for (string op : ops)
+  size_t end = 0;
+  for (int i = 0; i < 4; ++i)
   {
-    bool done = false;
-    string code; // meet first correct command
-    while (!(code = cut(op)).empty() && !done)
+    end = str.find_first_not_of(" \t", end);
+    if (end == std::string_view::npos) return;
+    end = std::min(str.find_first_of(" \t", end), str.length());
+  }
+
+  const std::string_view fen = str.substr(0, end);
+  str.remove_prefix(end);
+  if (!B.set(fen)) return;
+  problem.fen = fen;
+
+  while (!str.empty() && (str.back() == ';' || str.back() == ' ')) str.remove_suffix(1);
+
+  while (!str.empty())
+  {
+    std::string_view op = cut(str, ";");
+    std::string_view code; // meet first correct command
+    while (!op.empty())
     {
-      done = true;
+      code = cut(op);
+      if (code == "bm" || code == "am" || code == "id") break;
+      if (code.length() == 2 && (code[0] == 'c' || code[0] == 'D') && isdigit(code[1])) break;
+      code = {};
+    }
 
-      if (code == "bm")
+    std::string_view arg = op;
+    while (arg.starts_with(' ')) arg.remove_prefix(1);
+    if (arg.size() > 1 && arg.front() == '"' && arg.back() == '"')
+      arg = arg.substr(1, arg.size() - 2);
+
+    if (code == "bm")
+    {
+      while (!arg.empty())
       {
-        Move move = B.parse_san(op);
+        Move move = B.parse_san(cut(arg));
         if (move != Move::None)
           problem.best[move] = 0;
       }
-      else if (code == "am")
-      {
-        Move move = B.parse_san(op);
-        if (move != Move::None)
-          problem.avoid = move;
-      }
-      else if (code == "id")
-      {
-        problem.id = trim(op, '"');
-      }
-      else if (code.length() == 2
-           &&  code[0] == 'c'
-           &&  isdigit(code[1]))
-      {
-        int i = code[1] - '0';
-        problem.comment[i] = trim(op, '"');
-      }
-      else if (code.length() == 2
-           &&  code[0] == 'D'
-           &&  isdigit(code[1]))
-      {
-        int i = code[1] - '0';
-        problem.perft[i] = parse_int(op, 0);
-      }
-      else
-      {
-        done = false;
-      }
+    }
+    else if (code == "am")
+    {
+      Move move = B.parse_san(cut(arg));
+      if (move != Move::None)
+        problem.avoid = move;
+    }
+    else if (code == "id")
+    {
+      problem.id = arg;
+    }
+    else if (code.length() == 2
+         &&  code[0] == 'c')
+    {
+      int i = code[1] - '0';
+      problem.comment[i] = arg;
+    }
+    else if (code.length() == 2
+         &&  code[0] == 'D')
+    {
+      int i = code[1] - '0';
+      problem.perft[i] = parse_u64(arg, 0);
     }
   }
 
@@ -81,25 +114,22 @@ Problem Epd::parse_problem(std::string str)
   if (!problem.comment[8].empty()  // scores: "10 5 3"
   &&  !problem.comment[9].empty()) // moves: "f4f5 d4f2 f3g4"
   {
-    auto scores = split(problem.comment[8]);
-    auto moves  = split(problem.comment[9]);
-    bool sync = scores.size() == moves.size();
+    std::string_view scores = problem.comment[8];
+    std::string_view moves  = problem.comment[9];
 
-    for (int i = 0; i < moves.size(); ++i)
+    while (!moves.empty())
     {
-      Move move = to_move(moves[i]);
-      move = B.recognize(move);
+      std::string_view str = cut(moves);
+      std::string_view score = cut(scores);
+      if (str.empty()) continue;
 
+      Move move = B.recognize(to_move(str));
       if (move != Move::None)
-      {
-        int val = sync ? parse_int(scores[i], 0) : 0;
-        problem.best[move] = val;
-      }
+        problem.best[move] = parse_int(score, 0);
     }
   }
 
   problem.valid = true;
-  return problem;
 }
 
 }
@@ -1,4 +1,5 @@
 #pragma once
+#include <functional>
 #include <unordered_map>
 #include <unordered_set>
 #include <string>
@@ -10,26 +11,29 @@ namespace eia {
 using MoveScores = std::unordered_map<Move, int>;
 using MoveSet = std::unordered_set<Move, int>;
 
+// Views point into the mapped file, they are valid
+//  only until callback of Epd::scan returns
+
 struct Problem
 {
   bool valid = false;
-  std::string fen, id;
-  std::string comment[10];
+  std::string_view fen, id;
+  std::string_view comment[10];
   MoveScores best;
-  Move avoid;
-  int perft[10] = {0, };
+  Move avoid = Move::None;
+  u64 perft[10] = {0, };
 };
 
+// Problems are parsed from mapped file line by line and passed
+//  to callback, the same one is reused for the next line
+
 class Epd
 {
-  std::vector<Problem> problems;
-
 public:
-  bool read(std::string file);
-  const std::vector<Problem> & get_problems() { return problems; }
+  using Callback = std::function<void(const Problem &)>;
 
-private:
-  Problem parse_problem(std::string str);
+  static bool scan(std::string file, const Callback & fn);
+  static void parse(std::string_view line, Problem & problem, Board & B);
 };
 
 }
@@ -4,6 +4,7 @@
 #include "board.h"
 #include "value.h"
 #include "hash.h"
+#include "simd.h"
 
 using namespace std;
 
@@ -53,18 +54,72 @@ const Val safety_table[100] =
 // - wider passers             ??? elo
 
 Val Eval::eval(const Board * B, Val alpha, Val beta, bool use_phash)
+{
+  approx = false;
+
+#ifndef TUNING
+  // +70 elo (20s+.2s h2h-30)
+  if (B->is_simply_mated()) return -Val::Inf;
+
+  // network takes the place of all terms below
+  if (Nnue::on) return unzero(cp(Nnue::evaluate(B->acc, B->color)));
+#endif
+
+  int scale;
+  Duo duo = eval_base(B, use_phash, scale);
+
+  // Lazy eval - far from the window the rest of terms
+  //  can't bring score back, Lazy_Margin is measured
+  //  by 'lazy' command
+
+  if (!TRACE && lazy)
+  {
+    const Val rough = finish(B, duo, scale);
+    if (rough + Lazy_Margin <= alpha
+    ||  rough - Lazy_Margin >= beta)
+    {
+      approx = true;
+      return rough;
+    }
+  }
+
+  // collecting ei here
+  duo += evalxrays<White>(B) - evalxrays<Black>(B);
+
+  duo += evaluateN<White>(B) - evaluateN<Black>(B);
+  duo += evaluateB<White>(B) - evaluateB<Black>(B);
+  duo += evaluateR<White>(B) - evaluateR<Black>(B);
+  duo += evaluateQ<White>(B) - evaluateQ<Black>(B);
+  duo += evaluateK<White>(B) - evaluateK<Black>(B);
+
+  duo += eval_passers<White>(B) - eval_passers<Black>(B);
+  duo += eval_threats(B);
+
+  Duo ksafety = Duo::both(ei.king_safety());
+  duo += ksafety;
+
+  return finish(B, duo, scale);
+}
+
+Val Eval::estimate(const Board * B)
+{
+  int scale;
+  Duo duo = eval_base(B, false, scale);
+  return finish(B, duo, scale);
+}
+
+// Material, pst and pawns - the cheap part of eval
+
+Duo Eval::eval_base(const Board * B, bool use_phash, int & scale)
 {
   ei.init(B);
   Duo duo{};
 
 #ifdef TUNING
   T.clear();
-#else
-  // +70 elo (20s+.2s h2h-30)
-  if (B->is_simply_mated()) return -Val::Inf;
 #endif
 
-  int scale = 128;
+  scale = 128;
 
   if (is_correct(B->mkey))
   {
@@ -72,33 +127,34 @@ Val Eval::eval(const Board * B, Val alpha, Val beta, bool use_phash)
     scale = matinfo.scale;
   }
 
+#ifdef TUNING
   for (Piece p = BP; p < BK; ++p) // material
   {
     const int cnt = popcnt(B->piece[p]);
     duo += apply(col(p) ? cnt : -cnt, MatValue, pt(p));
   }
-
-  // collecting ei here
-  duo += evalxrays<White>(B) - evalxrays<Black>(B);
+#else
+  duo += B->state.psq; // material and pst, kept by board
+#endif
 
   // Pawn-king hash table | +27.85 elo (5+.05 h2h-100)
 
   Duo pvals;
 
-  if (!no_hash && use_phash && !TRACE)
+  if (!no_hash && use_phash && phash && !TRACE)
   {
-    auto pk = Hash::pk_probe(B->state.pkhash);
-    if (pk == nullptr)
+    Hash::PK_Entry pk;
+    if (!phash->probe(B->state.pkhash, pk))
     {
       pvals = evaluateP<White>(B) - evaluateP<Black>(B);
-      Hash::pk_store(B->state.pkhash, pvals, ei.weak, ei.passers);
+      phash->store(B->state.pkhash, pvals, ei.weak, ei.passers);
     }
     else
     {
-      pvals = pk->vals;
-      ei.weak[0] = pk->weak & B->occ[0];
-      ei.weak[1] = pk->weak & B->occ[1];
-      ei.passers = pk->passers;
+      pvals = pk.vals;
+      ei.weak[0] = pk.weak & B->occ[0];
+      ei.weak[1] = pk.weak & B->occ[1];
+      ei.passers = pk.passers;
     }
   }
   else
@@ -107,18 +163,11 @@ Val Eval::eval(const Board * B, Val alpha, Val beta, bool use_phash)
   }
 
   duo += pvals;
-  duo += evaluateN<White>(B) - evaluateN<Black>(B);
-  duo += evaluateB<White>(B) - evaluateB<Black>(B);
-  duo += evaluateR<White>(B) - evaluateR<Black>(B);
-  duo += evaluateQ<White>(B) - evaluateQ<Black>(B);
-  duo += evaluateK<White>(B) - evaluateK<Black>(B);
-
-  duo += eval_passers<White>(B) - eval_passers<Black>(B);
-  duo += eval_threats<White>(B) - eval_threats<Black>(B);
-
-  Duo ksafety = Duo::both(ei.king_safety());
-  duo += ksafety;
+  return duo;
+}
 
+Val Eval::finish(const Board * B, const Duo & duo, int scale)
+{
   const int progress = 100 - std::max(B->state.fifty, 68);
   const int phase = B->phase();
 
@@ -195,7 +244,8 @@ Duo Eval::evaluateP(const Board * B)
     const int r = Col ? rank(sq) : 7 - rank(sq);
 
     // pst
-    vals += apply<Col>(PST_P, neutral<Col>(sq));
+    if constexpr (TRACE) // else it is in B->state.psq
+      vals += apply<Col>(PST_P, neutral<Col>(sq));
 
     u64 back_friendly = front[~Col][sq] & B->piece[p];
     u64 fore_friendly = front[Col][sq] & B->piece[p];
@@ -393,7 +443,8 @@ Duo Eval::evaluateN(const Board * B)
 
     // pst & mobility
 
-    vals += apply<Col>(PST_N, neutral<Col>(sq));
+    if constexpr (TRACE) // else it is in B->state.psq
+      vals += apply<Col>(PST_N, neutral<Col>(sq));
 
     const u64 opp_pawns = ei.pawn_atts[~Col];
     const u64 safe_att = att & ~opp_pawns;
@@ -461,7 +512,8 @@ Duo Eval::evaluateB(const Board * B)
 
     // pst & mobility
 
-    vals += apply<Col>(PST_B, neutral<Col>(sq));
+    if constexpr (TRACE) // else it is in B->state.psq
+      vals += apply<Col>(PST_B, neutral<Col>(sq));
     vals += apply<Col>(MobB, popcnt(att));
 
     // bishop behind pawn
@@ -560,7 +612,8 @@ Duo Eval::evaluateR(const Board * B)
 
     // pst & mobility
 
-    vals += apply<Col>(PST_R, neutral<Col>(sq));
+    if constexpr (TRACE) // else it is in B->state.psq
+      vals += apply<Col>(PST_R, neutral<Col>(sq));
     vals += apply<Col>(MobR, popcnt(att));
 
     // adjustments
@@ -658,7 +711,8 @@ Duo Eval::evaluateQ(const Board * B)
 
     // pst & mobility
 
-    vals += apply<Col>(PST_Q, neutral<Col>(sq));
+    if constexpr (TRACE) // else it is in B->state.psq
+      vals += apply<Col>(PST_Q, neutral<Col>(sq));
     vals += apply<Col>(MobQ, popcnt(att));
 
     // queen on open/semi-files
@@ -674,7 +728,7 @@ Duo Eval::evaluateQ(const Board * B)
 
     // early queen
 
-    u64 undeveloped;
+    u64 undeveloped = 0ull;
     if constexpr (Col)
     {
       if (rank(sq) > 1)
@@ -709,7 +763,8 @@ Duo Eval::evaluateK(const Board * B)
 
     // pst
 
-    vals += apply<Col>(PST_K, neutral<Col>(sq));
+    if constexpr (TRACE) // else it is in B->state.psq
+      vals += apply<Col>(PST_K, neutral<Col>(sq));
 
     // pawn weakness
 
@@ -723,11 +778,8 @@ Duo Eval::evaluateK(const Board * B)
 }
 
 template<Color Col>
-Duo Eval::eval_threats(const Board * B)
+void Eval::threat_masks(const Board * B, u64 * masks)
 {
-  Duo vals{};
-  int cnt;
-
   // Shamelessly taken from Ethereal
 
   constexpr Color me = Col;
@@ -747,38 +799,52 @@ Duo Eval::eval_threats(const Board * B)
   const u64 weak_light = lights & poor_defend;
 
   // Penalty for each of our poorly supported pawns
-  cnt = popcnt(B->piece[BP ^ Col] & ~pawns_atts & poor_defend);
-  vals += apply<Col>(cnt, ThreatPawn);
+  masks[0] = B->piece[BP ^ Col] & ~pawns_atts & poor_defend;
 
   // lights <- pawns
-  cnt = popcnt(lights & pawns_atts);
-  vals += apply<Col>(cnt, ThreatL_P);
+  masks[1] = lights & pawns_atts;
 
   // lights <- lights
-  cnt = popcnt(lights & light_atts);
-  vals += apply<Col>(cnt, ThreatL_L);
+  masks[2] = lights & light_atts;
 
   // weak lights <- heavy
-  cnt = popcnt(weak_light & heavy_atts);
-  vals += apply<Col>(cnt, ThreatL_H);
+  masks[3] = weak_light & heavy_atts;
 
   // weak lights <- king
-  cnt = popcnt(weak_light & ei.attacked_by[opp][King]);
-  vals += apply<Col>(cnt, ThreatL_K);
+  masks[4] = weak_light & ei.attacked_by[opp][King];
 
   // rooks <- pawns, lights
-  cnt = popcnt(rooks & (pawns_atts | light_atts));
-  vals += apply<Col>(cnt, ThreatR_L);
+  masks[5] = rooks & (pawns_atts | light_atts);
 
   // weak rooks <- king
-  cnt = popcnt(rooks & poor_defend & ei.attacked_by[opp][King]);
-  vals += apply<Col>(cnt, ThreatR_K);
+  masks[6] = rooks & poor_defend & ei.attacked_by[opp][King];
 
   // queens <- any
-  cnt = popcnt(queens & ei.attacked[opp]);
-  vals += apply<Col>(cnt, ThreatQ_1);
+  masks[7] = queens & ei.attacked[opp];
+}
 
-  return vals;
+// Counts of both colors go to one vector kernel with weights
+//  signed by color, trace needs them one by one
+
+Duo Eval::eval_threats(const Board * B)
+{
+  u64 masks[Color_N * Threat_N];
+  threat_masks<White>(B, masks);
+  threat_masks<Black>(B, masks + Threat_N);
+
+  if constexpr (TRACE)
+  {
+    Duo vals{};
+    for (int i = 0; i < Threat_N; i++)
+    {
+      const Term term = (Term)(ThreatPawn + i);
+      vals += apply<White>(popcnt(masks[i]), term);
+      vals -= apply<Black>(popcnt(masks[Threat_N + i]), term);
+    }
+    return vals;
+  }
+
+  return Simd::weighted_popcnt(masks, threat_weights, Color_N * Threat_N);
 }
 
 //////////////////
@@ -1452,45 +1518,47 @@ void Eval::init_term_arrays()
   });
 }
 
-void Eval::init_inner()
+void Eval::init_psq() const
 {
-  // ------------------------------
-  //  PST
-  // ------------------------------
-
-  for (int i = 0; i < 12; i++)
-    for (int sq = 0; sq < 64; sq++)
-      pst[i][sq].clear();
-
-  for (PieceType pt = Pawn; pt < PieceType_N; ++pt)
+  for (Piece p = BP; p < Piece_N; ++p)
   {
-    const Term term = (Term)(PST_P + pt);
+    const Term term = (Term)(PST_P + (int)pt(p));
 
     for (SQ sq = A1; sq < SQ_N; ++sq)
     {
-      const Piece p = to_piece(pt, White);
-      const Duo vals = get(term, sq);
+      Duo vals = get(term, col(p) ? neutral<White>(sq) : neutral<Black>(sq));
+      if (!is_king(p)) vals += get(MatValue, pt(p));
 
-      pst[p][sq]           =  vals;
-      pst[opp(p)][opp(sq)] =  vals; // same sign!
+      psq[p][sq] = col(p) ? vals : -vals;
     }
   }
+}
+
+void Eval::init_inner()
+{
+  // ------------------------------
+  //  Material & PST
+  // ------------------------------
 
-  // Show
+  // Board sums them up incrementally, tuner doesn't use
+  //  that as it needs trace and has evals with own params.
+  // Table is global, so only E[0] builds it: copies are made
+  //  by solvers while other threads' boards are reading it
 
-  /*for (Piece p = WP; p < Piece_N; p = p + 2)
-  {
-    log("init_term(PST_{}, \n{{", to_char(p));
+#ifndef TUNING
+  if (this == &E[0]) init_psq();
+#endif
 
-    for (SQ sq = A1; sq < SQ_N; ++sq)
-    {
-      if (!(sq & 3)) log("\n");
-      log("  {{{: >9.4f}, {: >9.4f}}}, ",
-        dry_double(pst[p][sq].op),
-        dry_double(pst[p][sq].eg));
-    }
-    log("\n}});\n\n");
-  }*/
+  // ------------------------------
+  //  Threats
+  // ------------------------------
+
+  for (int i = 0; i < Threat_N; i++)
+  {
+    const Duo vals = get((Term)(ThreatPawn + i));
+    threat_weights[i] = vals;
+    threat_weights[Threat_N + i] = -vals;
+  }
 
   // ------------------------------
   //  Material info
@@ -1532,6 +1600,6 @@ template Duo Eval::evaluateK<White>(const Board * B);
 template Duo Eval::eval_passers<Black>(const Board * B);
 template Duo Eval::eval_passers<White>(const Board * B);
 
-template Duo Eval::eval_threats<Black>(const Board * B);
-template Duo Eval::eval_threats<White>(const Board * B);
+template void Eval::threat_masks<Black>(const Board * B, u64 * masks);
+template void Eval::threat_masks<White>(const Board * B, u64 * masks);
 }
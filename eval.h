@@ -15,6 +15,7 @@ static constexpr bool TRACE = false;
 namespace eia {
 
 const Val Tempo = 15_cp;
+const Val Lazy_Margin = 520_cp; // measured by 'lazy' command
 
 enum { OP, EG };
 
@@ -148,6 +149,10 @@ enum Term
 
 constexpr int Param_N = TERMS 0;
 
+// threat terms go in a row, the vector kernel relies on it
+constexpr int Threat_N = ThreatQ_1 - ThreatPawn + 1;
+static_assert(Threat_N == 8);
+
 #undef TERM
 #undef TERM_ARR
 #define TERM(group,x,op,eg)  #x,
@@ -216,11 +221,16 @@ struct EvalInfo
 };
 
 
+namespace Hash { class PK_Table; }
+
 class Eval
 {
   bool no_hash;
+  Hash::PK_Table * phash = nullptr; // owned by the searching thread
+  bool approx = false; // last eval was lazy
 
   Duo      data[Param_N];
+  Duo      threat_weights[Color_N * Threat_N]; // signed, white first
   TermInfo info[Term_N];
   EvalInfo ei;
 
@@ -228,18 +238,22 @@ class Eval
   Trace T;
 #endif
 
-  Duo pst[12][64];
   MatInfo mattable[+MatKey::Total];
 
 public:
+  static inline bool lazy = true; // switched by LazyEval option
+
   Eval(const Tune & tune = {}, bool no_hash = false);
   void init_inner();
+  void init_psq() const;
   void init_term_arrays();
   void init_term(int idx, const std::vector<std::pair<f64, f64>> & arr);
 
   INLINE Duo get(Term term, int index = 0) const;
 
   Val eval(const Board * B, Val alpha, Val beta, bool use_phash = true);
+  Val estimate(const Board * B); // what lazy eval decides on
+  bool was_lazy() const { return approx; }
   Val mopup(const Board * B, Color weaker);
 
   Bounds bounds() const;
@@ -249,11 +263,15 @@ public:
   void set(const Eval & eval);
   void set(const Tune & tune);
   Tune to_tune() const;
+  void attach(Hash::PK_Table * table) { phash = table; }
 
   std::string to_raw() const;
   void set_raw(std::string str, std::string delim = ",");
 
 private:
+  Duo eval_base(const Board * B, bool use_phash, int & scale);
+  Val finish(const Board * B, const Duo & duo, int scale);
+
   template<Color Col> Duo evalxrays(const Board * B);
   template<Color Col> Duo evaluateP(const Board * B);
   template<Color Col> Duo evaluateN(const Board * B);
@@ -263,7 +281,8 @@ private:
   template<Color Col> Duo evaluateK(const Board * B);
 
   template<Color Col> Duo eval_passers(const Board * B);
-  template<Color Col> Duo eval_threats(const Board * B);
+  template<Color Col> void threat_masks(const Board * B, u64 * masks);
+  Duo eval_threats(const Board * B);
 
   template<Color Col = White>
   INLINE Duo apply(int mult, int div, Term term, int offset = 0)
@@ -1,4 +1,7 @@
 #pragma once
+#include <algorithm>
+#include <atomic>
+#include <new>
 #include "consts.h"
 #include "moves.h"
 #include "value.h"
@@ -7,15 +10,18 @@
 
 namespace eia::Hash {
 
-// This hash model partly borrowed from Ethereal
+// This hash model partly borrowed from Ethereal and Stockfish
 //
-//  - no bucket system, no aging
-//  - replacement is simply 'always'
+//  - buckets of 4 entries fill exactly one cache line
+//  - generation is bumped every search, replacement prefers
+//    shallow entries and ones left from previous searches
+//  - slots are two atomic words, the key is xor-ed with data
+//    so torn writes from other threads just look like misses
 //  - full values for scores (+50 elo | 20+.2s h2h-20)
 
 enum Type { None, Lower, Upper, Exact };
 
-struct alignas(16) Entry
+struct Entry
 {
   u32 key32;      // 4
   Move move;      // 2
@@ -35,89 +41,176 @@ inline Val val_to(Val val, int height)
        : val <= -Val::Mate ? val - cp(height) : val;
 }
 
-inline u16 key_high(u64 key)
+inline u32 key_low(u64 key) // high bits are used for indexing
 {
-  return static_cast<u16>(key >> 32);
+  return static_cast<u32>(key);
 }
 
-const Entry entry0 { 0ull, Move::None, 0u, 0u, Val::Zero, Val::Zero };
+const Entry entry0 { 0u, Move::None, 0u, 0u, Val::Zero, Val::Zero };
+
+// Packed entry: lock | val in the first word,
+//  move | depth | generation & type | eval in the second
+
+struct Slot
+{
+  std::atomic<u64> lock_val;
+  std::atomic<u64> data;
+};
+
+constexpr int Bucket_N = 4;
+constexpr u8 Gen_Step = 4; // lower two bits are for type
+constexpr u8 Gen_Mask = 0xFC;
+
+struct alignas(64) Bucket
+{
+  Slot slots[Bucket_N];
+};
+
+static_assert(sizeof(Bucket) == 64);
 
 
 class Table
 {
-  int size;
-  Entry * table;
+  u64 size = 0; // in buckets
+  u8 gen = 0;
+  Bucket * table = nullptr;
 
 public:
-  Table(int size_mb = HashTables::Size) { init(size_mb); }
-  ~Table() { delete[] table; table = nullptr; }
+  Table(MB size_mb = HashTables::Size) { init(size_mb); }
+  ~Table() { large_free(table); table = nullptr; }
 
-  void clear()
+  // placement new also makes the first touch of memory
+  //  so pages are spread between the threads clearing them
+
+  void clear(int threads = 1)
   {
-    for (int i = 0; i < size; ++i)
-      table[i] = entry0;
+    const i64 n = static_cast<i64>(size);
+
+    #pragma omp parallel for num_threads(threads) schedule(static)
+    for (i64 i = 0; i < n; ++i)
+      new (&table[i]) Bucket();
+
+    gen = 0;
   }
 
-  void init(int size_mb)
+  void init(MB size_mb, int threads = 1)
   {
-    constexpr int entry_sz = sizeof(Entry);
+    size = (static_cast<u64>(size_mb) << 20) / sizeof(Bucket);
 
-    if constexpr (only_one(entry_sz))
-    {
-      assert(size_mb <= 2048 * entry_sz);
-      size = size_mb << (20 - bitscan(entry_sz));
-    }
-    else // ensure it has power of two
+    if (table != nullptr) large_free(table);
+    table = static_cast<Bucket *>(large_alloc(size * sizeof(Bucket)));
+
+    if (table == nullptr) // not enough memory
     {
-      assert(size_mb <= 2048);
-      int n = (size_mb << 20) / sizeof(Entry);
-      size = msb(n);
+      size = (static_cast<u64>(HashTables::Size) << 20) / sizeof(Bucket);
+      table = static_cast<Bucket *>(large_alloc(size * sizeof(Bucket)));
     }
-    
-    if (table != nullptr) delete[] table;
-    table = new Entry[size];
 
-    clear();
+    clear(threads);
   }
 
-  bool probe(u64 key, int height, Entry & entry)
+  MB size_mb() const { return static_cast<MB>((size * sizeof(Bucket)) >> 20); }
+
+  void new_search() { gen += Gen_Step; }
+
+  void prefetch(u64 key) const { eia::prefetch(&table[mul_hi(key, size)]); }
+
+  bool probe(u64 key, int height, Entry & entry) const
   {
-    Entry & e = table[key & (size - 1)];
+    const Bucket & bucket = table[mul_hi(key, size)];
 
-    if (e.key32 != key_high(key)) return false;
+    for (const Slot & slot : bucket.slots)
+    {
+      if (!unpack(slot, key, entry)) continue;
 
-    Entry result = e;
-    result.val = val_from(result.val, height);
-    entry = result; 
-    return true;
+      entry.val = val_from(entry.val, height);
+      return true;
+    }
+    return false;
   }
 
   void store(u64 key, int height, Move move, Val val, Val eval, int depth, Type type)
   {
-    Entry & entry = table[key & (size - 1)];
+    Bucket & bucket = table[mul_hi(key, size)];
+    Slot * replace = &bucket.slots[0];
+    int worst = limits<int>::max();
+    Entry old;
 
-    if (type != Type::Exact
-    &&  key_high(key) == entry.key32
-    &&  depth < entry.depth - 2) return;
-
-    entry = Entry
+    for (Slot & slot : bucket.slots)
     {
-      key_high(key), move,
-      (u8)depth, (u8)type,
-      val_to(val, height),
-      eval
-    };
+      if (unpack(slot, key, old))
+      {
+        if (type != Type::Exact
+        &&  depth < old.depth - 2) return;
+
+        if (is_empty(move)) move = old.move; // keep known move
+        replace = &slot;
+        break;
+      }
+
+      // the shallowest and oldest entry is going to be replaced
+
+      const u64 data = slot.data.load(std::memory_order_relaxed);
+      const u8 old_depth = static_cast<u8>(data >> 16);
+      const u8 old_gen = static_cast<u8>(data >> 24) & Gen_Mask;
+      const int age = static_cast<u8>(gen - old_gen) / Gen_Step;
+      const int score = old_depth - 8 * age;
+
+      if (score < worst)
+      {
+        worst = score;
+        replace = &slot;
+      }
+    }
+
+    const u64 data = static_cast<u64>(move)
+                   | static_cast<u64>(static_cast<u8>(depth)) << 16
+                   | static_cast<u64>(gen | type) << 24
+                   | static_cast<u64>(static_cast<u32>(eval)) << 32;
+
+    const u32 lock = key_low(key) ^ fold(data);
+    const u64 lock_val = static_cast<u64>(lock) << 32
+                       | static_cast<u32>(val_to(val, height));
+
+    replace->data.store(data, std::memory_order_relaxed);
+    replace->lock_val.store(lock_val, std::memory_order_relaxed);
   }
 
   int hashfull() const
   {
     int used = 0; // good estimate
-    
-    for (int i = 0; i < 1000; i++)
-      used += !!table[i].type;
-    
+
+    for (int i = 0; i < 1000 / Bucket_N; i++)
+      for (const Slot & slot : table[i].slots)
+      {
+        const u8 genbound = static_cast<u8>(slot.data.load(std::memory_order_relaxed) >> 24);
+        used += (genbound & 3) && (genbound & Gen_Mask) == gen;
+      }
+
     return used;
   }
+
+private:
+  static u32 fold(u64 data)
+  {
+    return static_cast<u32>(data) ^ static_cast<u32>(data >> 32);
+  }
+
+  static bool unpack(const Slot & slot, u64 key, Entry & entry)
+  {
+    const u64 lock_val = slot.lock_val.load(std::memory_order_relaxed);
+    const u64 data = slot.data.load(std::memory_order_relaxed);
+
+    if ((lock_val >> 32) != (key_low(key) ^ fold(data))) return false;
+
+    entry.key32 = key_low(key);
+    entry.move  = static_cast<Move>(data & 0xFFFF);
+    entry.depth = static_cast<u8>(data >> 16);
+    entry.type  = static_cast<u8>(data >> 24) & 3;
+    entry.val   = static_cast<Val>(static_cast<i32>(lock_val));
+    entry.eval  = static_cast<Val>(static_cast<i32>(data >> 32));
+    return true;
+  }
 };
 
 
@@ -125,32 +218,136 @@ public:
 //  Pawn hash table with kings positions
 // --------------------------------------------
 
+// Pawns never stand on ranks 1 and 8, so masks of weak pawns
+//  and passers keep 16 bits of the key check each there, entry
+//  is 24 bytes with 32-bit check, probes and hits are counted
+
 struct PK_Entry
 {
-  u64 key, weak, passers;
+  u64 weak, passers;
   Duo vals;
 };
 
-constexpr int PK_HASH_BITS = 17;
-constexpr int PK_HASH_MASK = (1 << PK_HASH_BITS) - 1;
+class PK_Table
+{
+  PK_Entry * table = nullptr;
+  u64 size = 0; // in entries
+  u64 probes = 0, hits = 0;
 
-static PK_Entry pk_table[1 << PK_HASH_BITS]{}; // 4 mb
+public:
+  PK_Table(MB size_mb = HashTables::PK_Size) { init(size_mb); }
+  ~PK_Table() { delete[] table; }
 
-inline PK_Entry const * pk_probe(u64 key)
-{
-  PK_Entry const * entry = &pk_table[key & PK_HASH_MASK];
-  return entry->key == key ? entry : nullptr;
-}
+  PK_Table(const PK_Table &) = delete;
+  PK_Table & operator = (const PK_Table &) = delete;
 
-inline void pk_store(u64 key, Duo vals, u64 weak[2], u64 passers = 0ull)
+  void init(MB size_mb)
+  {
+    delete[] table;
+    size = (static_cast<u64>(size_mb) << 20) / sizeof(PK_Entry);
+    table = new PK_Entry[size]{};
+    probes = hits = 0;
+  }
+
+  MB size_mb() const { return static_cast<MB>((size * sizeof(PK_Entry)) >> 20); }
+  u64 get_probes() const { return probes; }
+  u64 get_hits() const { return hits; }
+
+  void prefetch(u64 key) const { eia::prefetch(&table[mul_hi(key, size)]); }
+
+  bool probe(u64 key, PK_Entry & entry)
+  {
+    const PK_Entry & slot = table[mul_hi(key, size)];
+    probes++;
+
+    if ((gather(slot.weak) | gather(slot.passers) << 16) != key_low(key))
+      return false;
+
+    entry.weak = slot.weak & ~(Rank1 | Rank8);
+    entry.passers = slot.passers & ~(Rank1 | Rank8);
+    entry.vals = slot.vals;
+
+    hits++;
+    return true;
+  }
+
+  void store(u64 key, Duo vals, u64 weak[2], u64 passers = 0ull)
+  {
+    const u32 lock = key_low(key);
+
+    table[mul_hi(key, size)] =
+    {
+      .weak = weak[0] | weak[1] | spread(lock),
+      .passers = passers | spread(lock >> 16),
+      .vals = vals
+    };
+  }
+
+private:
+  static u64 spread(u32 x) // 16 bits to ranks 1 and 8
+  {
+    return (x & 0xFF) | static_cast<u64>((x >> 8) & 0xFF) << 56;
+  }
+
+  static u32 gather(u64 bb)
+  {
+    return static_cast<u32>((bb & 0xFF) | (bb >> 56) << 8);
+  }
+};
+
+
+// --------------------------------------------
+//  Static eval cache
+// --------------------------------------------
+
+// Direct-mapped and per thread, lock | val in one word, eval is
+//  never zero (unzero) so an empty slot can't be taken for hit
+
+class Eval_Table
 {
-  pk_table[key & PK_HASH_MASK] =
+  u64 * table = nullptr;
+  u64 size = 0; // in entries
+  u64 probes = 0, hits = 0;
+
+public:
+  Eval_Table(MB size_mb = HashTables::EV_Size) { init(size_mb); }
+  ~Eval_Table() { delete[] table; }
+
+  Eval_Table(const Eval_Table &) = delete;
+  Eval_Table & operator = (const Eval_Table &) = delete;
+
+  void init(MB size_mb)
   {
-    .key = key,
-    .weak = weak[0] | weak[1],
-    .passers = passers,
-    .vals = vals
-  };
-}
+    delete[] table;
+    size = (static_cast<u64>(size_mb) << 20) / sizeof(u64);
+    table = new u64[size]{};
+    reset_stats();
+  }
+
+  void clear() { std::fill(table, table + size, 0ull); }
+  void reset_stats() { probes = hits = 0; }
+
+  u64 get_probes() const { return probes; }
+  u64 get_hits() const { return hits; }
+
+  bool probe(u64 key, Val & val)
+  {
+    const u64 slot = table[mul_hi(key, size)];
+    probes++;
+
+    if (static_cast<u32>(slot >> 32) != key_low(key)
+    ||  static_cast<u32>(slot) == 0) return false;
+
+    val = static_cast<Val>(static_cast<i32>(slot));
+    hits++;
+    return true;
+  }
+
+  void store(u64 key, Val val)
+  {
+    table[mul_hi(key, size)] = static_cast<u64>(key_low(key)) << 32
+                             | static_cast<u32>(val);
+  }
+};
 
 }
@@ -6,7 +6,7 @@
 using namespace std;
 using namespace eia;
 
-int main()
+int main(int argc, char * argv[])
 {
   if (Input.is_console())
   {
@@ -17,6 +17,19 @@ int main()
   //log("{}\n", E->prettify());
 
   Engine * engine = new Engine;
+
+  if (argc > 1) // run single command, e.g. "eia bench 13"
+  {
+    string cmd;
+    for (int i = 1; i < argc; i++)
+      cmd += (i > 1 ? " " : "") + string(argv[i]);
+
+    engine->new_game();
+    engine->parse(cmd);
+    engine->wait();
+    return 0;
+  }
+
   engine->start();
 
   return 0;
@@ -91,8 +91,8 @@ void MoveList::value_quiets(const Board * B, const History & history)
     const SQ from = get_from(move(mv));
     const SQ to   = get_to(move(mv));
 
-    const bool leave_threat = B->state.threats & bit(from);
-    const bool enter_threat = B->state.threats & bit(to);
+    const bool leave_threat = B->threats() & bit(from);
+    const bool enter_threat = B->threats() & bit(to);
     
     u64 val = history[B->color][leave_threat][enter_threat][from][to];
     *ptr += (O_Quiet + val) << 32;
@@ -75,10 +75,9 @@ public:
 
   std::vector<Move> to_moves()
   {
-    Move move;
     std::vector<Move> moves;
-    while (!is_empty(move = get_next()))
-      moves.push_back(move);
+    while (!empty())
+      moves.push_back(get_next());
     return moves;
   }
 
@@ -84,7 +84,8 @@ Move MovePicker<QS>::get_next(bool do_quiets)
       stage = Stage::Killer2;
       if (do_quiets
       &&  killer[0] != hash_mv
-      &&  B->pseudolegal(killer[0])) return killer[0];
+      &&  B->pseudolegal(killer[0])
+      &&  B->legal(killer[0])) return killer[0];
 
       [[fallthrough]];
 
@@ -93,7 +94,8 @@ Move MovePicker<QS>::get_next(bool do_quiets)
       stage = Stage::CounterMove;
       if (do_quiets
       &&  killer[1] != hash_mv
-      &&  B->pseudolegal(killer[1])) return killer[1];
+      &&  B->pseudolegal(killer[1])
+      &&  B->legal(killer[1])) return killer[1];
 
       [[fallthrough]];
 
@@ -104,7 +106,8 @@ Move MovePicker<QS>::get_next(bool do_quiets)
       &&  counter != hash_mv
       &&  counter != killer[0]
       &&  counter != killer[1]
-      &&  B->pseudolegal(counter)) return counter;
+      &&  B->pseudolegal(counter)
+      &&  B->legal(counter)) return counter;
 
       [[fallthrough]];
 
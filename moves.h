@@ -49,7 +49,7 @@ enum Move : u16 { None = to_move(A1, A1), Null = to_move(B1, B1) };
 
 using Moves = std::vector<Move>;
 
-static Move to_move(std::string str)
+static Move to_move(std::string_view str)
 {
   if (str.length() < 4) return Move::None;
 
@@ -0,0 +1,69 @@
+#include <algorithm>
+#include <fstream>
+#include <memory>
+#include "nnue.h"
+#include "simd.h"
+
+using namespace std;
+
+namespace eia::Nnue {
+
+const Network * net = nullptr;
+
+static unique_ptr<Network> loaded;
+static string loaded_file;
+
+// The file is read into a fresh network, so the loaded one is
+//  kept if this one is broken
+
+bool load(const string & file)
+{
+  ifstream in(file, ios::binary);
+  if (!in) return false;
+
+  char magic[4] = {};
+  u32 hidden = 0;
+  in.read(magic, sizeof(magic));
+  in.read(reinterpret_cast<char *>(&hidden), sizeof(hidden));
+  if (!in || string(magic, 4) != "EIAN" || hidden != Hidden) return false;
+
+  auto fresh = make_unique<Network>();
+  in.read(reinterpret_cast<char *>(fresh->ft_weights),  sizeof(fresh->ft_weights));
+  in.read(reinterpret_cast<char *>(fresh->ft_bias),     sizeof(fresh->ft_bias));
+  in.read(reinterpret_cast<char *>(fresh->out_weights), sizeof(fresh->out_weights));
+  in.read(reinterpret_cast<char *>(&fresh->out_bias),   sizeof(fresh->out_bias));
+  if (!in || in.peek() != char_traits<char>::eof()) return false;
+
+  loaded = std::move(fresh);
+  loaded_file = file;
+  net = loaded.get();
+  return true;
+}
+
+string file_name()
+{
+  return loaded_file;
+}
+
+void refresh(Accumulator & acc, const Piece * square)
+{
+  for (Color side : {Black, White})
+    for (int i = 0; i < Hidden; i++)
+      acc.v[side][i] = net->ft_bias[i];
+
+  for (SQ sq = A1; sq < SQ_N; ++sq)
+    if (square[sq] != NOP) add(acc, square[sq], sq);
+}
+
+int evaluate(const Accumulator & acc, Color stm)
+{
+  // Each half fits in int, the sum and its scaling may not
+
+  const i64 sum = static_cast<i64>(Simd::crelu_dot(acc.v[stm], net->out_weights, Hidden, QA))
+                + Simd::crelu_dot(acc.v[~stm], net->out_weights + Hidden, Hidden, QA);
+
+  const i64 score = (sum + net->out_bias) * Scale / (QA * QB);
+  return static_cast<int>(std::clamp<i64>(score, -Limit, Limit));
+}
+
+}
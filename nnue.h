@@ -0,0 +1,75 @@
+#pragma once
+#include <string>
+#include "types.h"
+#include "piece.h"
+#include "square.h"
+
+namespace eia::Nnue {
+
+// Network 768 -> 2x256 -> 1: piece-square features seen by each
+//  side (own pieces first, board flipped for black), the first
+//  layer is shared and kept by Board in accumulator updated with
+//  every place/remove, output goes over clipped halves with the
+//  side to move first
+//
+// File (little endian): magic "EIAN", u32 hidden size, then i16
+//  arrays - ft weights [768][Hidden] and biases [Hidden] quantized
+//  by QA, out weights [2 * Hidden] by QB and out bias by QA * QB
+
+constexpr int Inputs = 768;
+constexpr int Hidden = 256;
+constexpr int QA = 255;
+constexpr int QB = 64;
+constexpr int Scale = 400;   // net output to cp
+constexpr int Limit = 10000; // cp, far from mate scores
+
+struct alignas(64) Network
+{
+  i16 ft_weights[Inputs * Hidden];
+  i16 ft_bias[Hidden];
+  i16 out_weights[2 * Hidden];
+  i16 out_bias;
+};
+
+struct alignas(64) Accumulator
+{
+  i16 v[Color_N][Hidden];
+
+  bool operator == (const Accumulator &) const = default;
+};
+
+extern const Network * net; // nullptr until loaded
+inline bool on = false;     // switched by UseNNUE option, needs net
+
+bool load(const std::string & file);
+std::string file_name();
+
+void refresh(Accumulator & acc, const Piece * square);
+int evaluate(const Accumulator & acc, Color stm); // in cp
+
+INLINE int feature(Color side, Piece p, SQ sq)
+{
+  const int rel = col(p) == side ? 0 : 1;
+  const int s = side == White ? +sq : +sq ^ 56;
+  return (rel * PieceType_N + pt(p)) * SQ_N + s;
+}
+
+inline void add(Accumulator & acc, Piece p, SQ sq)
+{
+  for (Color side : {Black, White})
+  {
+    const i16 * w = net->ft_weights + feature(side, p, sq) * Hidden;
+    for (int i = 0; i < Hidden; i++) acc.v[side][i] += w[i];
+  }
+}
+
+inline void sub(Accumulator & acc, Piece p, SQ sq)
+{
+  for (Color side : {Black, White})
+  {
+    const i16 * w = net->ft_weights + feature(side, p, sq) * Hidden;
+    for (int i = 0; i < Hidden; i++) acc.v[side][i] -= w[i];
+  }
+}
+
+}
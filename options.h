@@ -5,6 +5,7 @@
 #include <format>
 #include <vector>
 #include "types.h"
+#include "consts.h"
 #include "utils.h"
 
 namespace eia {
@@ -33,6 +34,8 @@ public:
   Option(OptionType type) : type(type) {}
   OptionType get_type() const { return type; }
   virtual std::string get_str() const { return ""; }
+  virtual int get_int() const { return 0; }
+  virtual std::string get_val() const { return ""; }
   virtual void set(std::string str) {}
 };
 
@@ -49,12 +52,14 @@ public:
 
   std::string get_str() const override
   {
-    return std::string("default ") + std::to_string(def);
+    return std::string("default ") + (def ? "true" : "false");
   }
 
-  void set(std::string str) override
+  int get_int() const override { return val; }
+
+  void set(std::string str) override // GUIs send true/false
   {
-    val = static_cast<bool>(parse_int(str));
+    val = str == "true" || parse_int(str);
   }
 };
 
@@ -78,6 +83,8 @@ public:
          + std::string(" max ") + std::to_string(max);
   }
 
+  int get_int() const override { return val; }
+
   void set(std::string str) override
   {
     val = parse_int(str);
@@ -103,6 +110,8 @@ public:
     return std::string("default ") + std::to_string(def);
   }
 
+  int get_int() const override { return val; }
+
   void set(std::string str) override
   {
     auto it = std::find(strings.begin(), strings.end(), str);
@@ -146,6 +155,8 @@ public:
     return std::string("default ") + def;
   }
 
+  std::string get_val() const override { return val; }
+
   void set(std::string str) override
   {
     val = str;
@@ -161,8 +172,14 @@ struct Options
 
   Options()
   {
-    add("Hash", new OptionSpin(4, 1, 1024));
+    add("Hash", new OptionSpin(HashTables::Size, 1, HashTables::Max));
+    add("Threads", new OptionSpin(1, 1, Limits::Threads));
+    add("PawnHash", new OptionSpin(HashTables::PK_Size, 1, HashTables::PK_Max));
     add("NullMove", new OptionCheck(false));
+    add("LazyEval", new OptionCheck(true));
+    add("EvalFile", new OptionString("<empty>"));
+    add("UseNNUE", new OptionCheck(false));
+    add("TunerThreads", new OptionSpin(0, 0, Limits::Threads)); // 0 - all cores
     add("OwnBook", new OptionCheck(false));
     add("UCI_ShowCurrLine", new OptionCheck(true));
     add("TestButton", new OptionButton("I am a button!"));
@@ -184,6 +201,18 @@ struct Options
     it->second->set(val);
   }
 
+  int get_int(std::string name) const
+  {
+    auto it = options.find(name);
+    return it == options.end() ? 0 : it->second->get_int();
+  }
+
+  std::string get_val(std::string name) const
+  {
+    auto it = options.find(name);
+    return it == options.end() ? "" : it->second->get_val();
+  }
+
   std::string to_string() const
   {
     std::string result;
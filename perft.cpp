@@ -0,0 +1,129 @@
+#include <algorithm>
+#include <format>
+#include <iostream>
+#include <new>
+#include <thread>
+#include <vector>
+#include "perft.h"
+#include "timer.h"
+
+using namespace std;
+
+namespace eia {
+
+const u64 Depth_Key = 0x9E3779B97F4A7C15ull; // golden ratio
+
+Perft::Perft(MB size_mb)
+{
+  size = (static_cast<u64>(std::min(size_mb, Max_Size)) << 20) / sizeof(Entry);
+  table = new (nothrow) Entry[size]();
+}
+
+Perft::~Perft()
+{
+  delete[] table;
+}
+
+// Entries are read and written without locks, a torn
+//  one doesn't pass the check of key ^ count
+
+bool Perft::probe(u64 key, u64 & cnt) const
+{
+  const Entry & entry = table[mul_hi(key, size)];
+  const u64 lock = entry.lock.load(memory_order_relaxed);
+  cnt = entry.count.load(memory_order_relaxed);
+  return (lock ^ cnt) == key;
+}
+
+void Perft::store(u64 key, u64 cnt)
+{
+  Entry & entry = table[mul_hi(key, size)];
+  entry.lock.store(key ^ cnt, memory_order_relaxed);
+  entry.count.store(cnt, memory_order_relaxed);
+}
+
+u64 Perft::count(Board & B, int depth)
+{
+  const u64 key = B.hash() ^ (Depth_Key * depth);
+
+  u64 cnt;
+  if (depth > 1 && probe(key, cnt)) return cnt;
+
+  MoveList ml;
+  B.generate_legal(ml);
+  if (depth <= 1) return ml.count();
+
+  cnt = 0ull;
+  while (!ml.empty())
+  {
+    const Move move = ml.get_next();
+    B.make(move);
+    cnt += count(B, depth - 1);
+    B.unmake(move);
+  }
+
+  store(key, cnt);
+  return cnt;
+}
+
+u64 Perft::leaves(const Board & board, int depth)
+{
+  if (depth <= 0) return 1;
+
+  Board B = board;
+  return count(B, depth);
+}
+
+u64 Perft::run(const Board & board, int depth, int threads)
+{
+  say("-- Perft {} (fast, threads {})\n", depth, threads);
+  say("{}", board.to_string());
+
+  Timestamp start = Clock::now();
+
+  Board root = board;
+
+  MoveList ml;
+  root.generate_legal(ml);
+
+  vector<Move> moves;
+  while (!ml.empty()) moves.push_back(ml.get_next());
+
+  vector<u64> counts(moves.size(), 1ull);
+  atomic<size_t> next = 0;
+
+  auto work = [&]()
+  {
+    Board B = root;
+
+    for (size_t i = next++; i < moves.size(); i = next++)
+    {
+      B.make(moves[i]);
+      if (depth > 1) counts[i] = count(B, depth - 1);
+      B.unmake(moves[i]);
+    }
+  };
+
+  vector<thread> helpers;
+  for (int i = 1; i < threads; i++) helpers.emplace_back(work);
+  work();
+  for (auto & helper : helpers) helper.join();
+
+  u64 total = 0ull;
+  for (size_t i = 0; i < moves.size(); i++)
+  {
+    say("{} - {}\n", moves[i], counts[i]);
+    total += counts[i];
+  }
+
+  i64 time = elapsed(start);
+  double knps = static_cast<double>(total) / (time + 1);
+
+  say("\nCount: {}\n", total);
+  say("Time: {} ms\n", time);
+  say("Speed: {:.2f} knps\n\n", knps);
+
+  return total;
+}
+
+}
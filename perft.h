@@ -0,0 +1,41 @@
+#pragma once
+#include <atomic>
+#include "board.h"
+
+namespace eia {
+
+// Fast perft for validation of move generator - leaves are bulk
+//  counted with legal generator, counts of subtrees are cached
+//  by (hash, depth) and root moves are shared between threads
+
+class Perft
+{
+  struct Entry
+  {
+    std::atomic<u64> lock;  // key ^ count
+    std::atomic<u64> count;
+  };
+
+  Entry * table;
+  u64 size;
+
+public:
+  static constexpr MB Max_Size = 1024; // goes next to TT, so bounded
+
+  Perft(MB size_mb);
+  ~Perft();
+
+  Perft(const Perft &) = delete;
+  Perft & operator = (const Perft &) = delete;
+
+  bool ok() const { return table != nullptr; } // allocated
+  u64 run(const Board & board, int depth, int threads = 1);
+  u64 leaves(const Board & board, int depth); // quiet, no threads
+
+private:
+  u64 count(Board & B, int depth);
+  bool probe(u64 key, u64 & cnt) const;
+  void store(u64 key, u64 cnt);
+};
+
+}
@@ -0,0 +1,258 @@
+#include <algorithm>
+#include "simd.h"
+#include "bitboard.h"
+
+#if defined(__x86_64__) || defined(_M_X64)
+  #define EIA_X86
+  #include <immintrin.h>
+  #ifdef _MSC_VER
+    #include <intrin.h>
+  #endif
+#endif
+
+// Code for wider units is compiled with their target attribute,
+//  so portable build still has it and runs it when CPU can
+
+#ifdef __GNUC__
+  #define TARGET(x) __attribute__((target(x)))
+#else
+  #define TARGET(x)
+#endif
+
+namespace eia::Simd {
+
+static_assert(sizeof(Duo) == 8); // loaded as op, eg pairs of i32
+
+static Duo weighted_popcnt_scalar(const u64 * masks, const Duo * weights, int n)
+{
+  Duo sum{};
+  for (int i = 0; i < n; i++)
+    sum += weights[i] * popcnt(masks[i]);
+  return sum;
+}
+
+static int crelu_dot_scalar(const i16 * x, const i16 * w, int n, int max)
+{
+  int sum = 0;
+  for (int i = 0; i < n; i++)
+    sum += std::clamp<int>(x[i], 0, max) * w[i];
+  return sum;
+}
+
+static OpEg sparse_dot_scalar(const float * w, const i32 * idx, const float * val, int n)
+{
+  OpEg sum{};
+  for (int i = 0; i < n; i++)
+  {
+    sum.op += w[2 * idx[i] + 0] * val[i];
+    sum.eg += w[2 * idx[i] + 1] * val[i];
+  }
+  return sum;
+}
+
+#ifdef EIA_X86
+
+// Popcount goes by nibbles through shuffle table (W. Mula), sums
+//  of bytes give the count in each 64-bit lane, then it is copied
+//  to the high half of the lane to multiply op and eg weights
+
+TARGET("avx2")
+static Duo weighted_popcnt_avx2(const u64 * masks, const Duo * weights, int n)
+{
+  const __m256i lookup = _mm256_setr_epi8(0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4,
+                                          0, 1, 1, 2, 1, 2, 2, 3, 1, 2, 2, 3, 2, 3, 3, 4);
+  const __m256i nibble = _mm256_set1_epi8(0x0F);
+  const __m256i zero = _mm256_setzero_si256();
+  __m256i sum = zero;
+
+  for (int i = 0; i < n; i += 4)
+  {
+    const __m256i v  = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(masks + i));
+    const __m256i lo = _mm256_shuffle_epi8(lookup, _mm256_and_si256(v, nibble));
+    const __m256i hi = _mm256_shuffle_epi8(lookup, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble));
+    const __m256i cnt = _mm256_sad_epu8(_mm256_add_epi8(lo, hi), zero);
+    const __m256i pair = _mm256_or_si256(cnt, _mm256_slli_epi64(cnt, 32));
+    const __m256i w = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(weights + i));
+    sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(pair, w));
+  }
+
+  __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+  s = _mm_add_epi32(s, _mm_unpackhi_epi64(s, s));
+  return Duo(static_cast<Val>(_mm_cvtsi128_si32(s)), static_cast<Val>(_mm_extract_epi32(s, 1)));
+}
+
+TARGET("avx512f,avx512vpopcntdq")
+static Duo weighted_popcnt_avx512(const u64 * masks, const Duo * weights, int n)
+{
+  __m512i sum = _mm512_setzero_si512();
+
+  for (int i = 0; i < n; i += 8)
+  {
+    const __m512i cnt = _mm512_popcnt_epi64(_mm512_loadu_si512(masks + i));
+    const __m512i pair = _mm512_or_si512(cnt, _mm512_slli_epi64(cnt, 32));
+    const __m512i w = _mm512_loadu_si512(weights + i);
+    sum = _mm512_add_epi32(sum, _mm512_mullo_epi32(pair, w));
+  }
+
+  const __m256i half = _mm256_add_epi32(_mm512_castsi512_si256(sum), _mm512_extracti64x4_epi64(sum, 1));
+  __m128i s = _mm_add_epi32(_mm256_castsi256_si128(half), _mm256_extracti128_si256(half, 1));
+  s = _mm_add_epi32(s, _mm_unpackhi_epi64(s, s));
+  return Duo(static_cast<Val>(_mm_cvtsi128_si32(s)), static_cast<Val>(_mm_extract_epi32(s, 1)));
+}
+
+// Clipped values fit in i16, madd gives pairwise sums in i32 lanes;
+//  it serves AVX-512 level too, 16-bit ops there need avx512bw
+
+TARGET("avx2")
+static int crelu_dot_avx2(const i16 * x, const i16 * w, int n, int max)
+{
+  const __m256i zero = _mm256_setzero_si256();
+  const __m256i top = _mm256_set1_epi16(static_cast<i16>(max));
+  __m256i sum = zero;
+
+  for (int i = 0; i < n; i += 16)
+  {
+    const __m256i v = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(x + i));
+    const __m256i c = _mm256_min_epi16(_mm256_max_epi16(v, zero), top);
+    const __m256i k = _mm256_loadu_si256(reinterpret_cast<const __m256i *>(w + i));
+    sum = _mm256_add_epi32(sum, _mm256_madd_epi16(c, k));
+  }
+
+  __m128i s = _mm_add_epi32(_mm256_castsi256_si128(sum), _mm256_extracti128_si256(sum, 1));
+  s = _mm_add_epi32(s, _mm_unpackhi_epi64(s, s));
+  s = _mm_add_epi32(s, _mm_shuffle_epi32(s, 1));
+  return _mm_cvtsi128_si32(s);
+}
+
+// Op/eg pair of param is gathered as one 64-bit lane, values
+//  are duplicated to match them, so lanes go op, eg, op, eg...
+
+TARGET("avx2,fma")
+static OpEg sparse_dot_avx2(const float * w, const i32 * idx, const float * val, int n)
+{
+  const __m256i dup = _mm256_setr_epi32(0, 0, 1, 1, 2, 2, 3, 3);
+  const long long * pairs = reinterpret_cast<const long long *>(w);
+  __m256 sum = _mm256_setzero_ps();
+
+  int i = 0;
+  for (; i + 4 <= n; i += 4)
+  {
+    const __m128i j = _mm_loadu_si128(reinterpret_cast<const __m128i *>(idx + i));
+    const __m256 p = _mm256_castsi256_ps(_mm256_i32gather_epi64(pairs, j, 8));
+    const __m256 v = _mm256_permutevar8x32_ps(_mm256_castps128_ps256(_mm_loadu_ps(val + i)), dup);
+    sum = _mm256_fmadd_ps(p, v, sum);
+  }
+
+  __m128 s = _mm_add_ps(_mm256_castps256_ps128(sum), _mm256_extractf128_ps(sum, 1));
+  s = _mm_add_ps(s, _mm_movehl_ps(s, s));
+
+  OpEg result{ _mm_cvtss_f32(s), _mm_cvtss_f32(_mm_shuffle_ps(s, s, 1)) };
+  for (; i < n; i++)
+  {
+    result.op += w[2 * idx[i] + 0] * val[i];
+    result.eg += w[2 * idx[i] + 1] * val[i];
+  }
+  return result;
+}
+
+#endif
+
+static bool supports(Level lvl)
+{
+#if defined(EIA_X86) && defined(__GNUC__)
+  __builtin_cpu_init();
+  switch (lvl)
+  {
+    case Level::AVX512: return __builtin_cpu_supports("avx512f")
+                            && __builtin_cpu_supports("avx512vpopcntdq");
+    case Level::AVX2:   return __builtin_cpu_supports("avx2")
+                            && __builtin_cpu_supports("fma");
+    default:            return true;
+  }
+#elif defined(EIA_X86) && defined(_MSC_VER)
+  int r[4];
+  __cpuid(r, 1);
+  if (!(r[2] & (1 << 27))) return lvl == Level::Scalar; // no OSXSAVE
+  const bool fma = r[2] & (1 << 12);
+
+  const u64 xcr0 = _xgetbv(0);
+  __cpuidex(r, 7, 0);
+  switch (lvl)
+  {
+    case Level::AVX512: return (xcr0 & 0xE6) == 0xE6
+                            && (r[1] & (1 << 16)) && (r[2] & (1 << 14));
+    case Level::AVX2:   return (xcr0 & 0x06) == 0x06 && (r[1] & (1 << 5)) && fma;
+    default:            return true;
+  }
+#else
+  return lvl == Level::Scalar;
+#endif
+}
+
+static Kernel kernel_for(Level lvl)
+{
+  switch (lvl)
+  {
+#ifdef EIA_X86
+    case Level::AVX512: return weighted_popcnt_avx512;
+    case Level::AVX2:   return weighted_popcnt_avx2;
+#endif
+    default:            return weighted_popcnt_scalar;
+  }
+}
+
+Level detect()
+{
+  if (supports(Level::AVX512)) return Level::AVX512;
+  if (supports(Level::AVX2))   return Level::AVX2;
+  return Level::Scalar;
+}
+
+static DotKernel dot_kernel_for(Level lvl)
+{
+#ifdef EIA_X86
+  if (lvl != Level::Scalar) return crelu_dot_avx2;
+#endif
+  return crelu_dot_scalar;
+}
+
+static SparseKernel sparse_kernel_for(Level lvl)
+{
+#ifdef EIA_X86
+  if (lvl != Level::Scalar) return sparse_dot_avx2;
+#endif
+  return sparse_dot_scalar;
+}
+
+static Level current = detect();
+Kernel weighted_popcnt = kernel_for(current);
+DotKernel crelu_dot = dot_kernel_for(current);
+SparseKernel sparse_dot = sparse_kernel_for(current);
+
+Level level()
+{
+  return current;
+}
+
+bool set_level(Level lvl)
+{
+  if (!supports(lvl)) return false;
+
+  current = lvl;
+  weighted_popcnt = kernel_for(lvl);
+  crelu_dot = dot_kernel_for(lvl);
+  sparse_dot = sparse_kernel_for(lvl);
+  return true;
+}
+
+std::string to_string(Level lvl)
+{
+  switch (lvl)
+  {
+    case Level::AVX512: return "avx512";
+    case Level::AVX2:   return "avx2";
+    default:            return "scalar";
+  }
+}
+
+}
@@ -0,0 +1,36 @@
+#pragma once
+#include <string>
+#include "types.h"
+#include "duo.h"
+
+namespace eia::Simd {
+
+// Eval kernels with packed lanes: op/eg go as paired 32-bit lanes,
+//  masks of both colors in parallel, the best of AVX-512, AVX2 and
+//  scalar code is picked at startup by CPU features
+
+enum class Level { Scalar, AVX2, AVX512 };
+
+// sum of popcnt(masks[i]) * weights[i], n is a multiple of 8
+using Kernel = Duo (*)(const u64 * masks, const Duo * weights, int n);
+
+extern Kernel weighted_popcnt;
+
+// sum of clamp(x[i], 0, max) * w[i], n is a multiple of 16,
+//  output layer of network
+using DotKernel = int (*)(const i16 * x, const i16 * w, int n, int max);
+
+extern DotKernel crelu_dot;
+
+// sum of w[idx[i]] * val[i] over op/eg pairs of w, for tuner
+struct OpEg { float op, eg; };
+using SparseKernel = OpEg (*)(const float * w, const i32 * idx, const float * val, int n);
+
+extern SparseKernel sparse_dot;
+
+Level detect();
+Level level();
+bool set_level(Level lvl); // false if CPU doesn't support it
+std::string to_string(Level lvl);
+
+}
@@ -1,4 +1,5 @@
 #pragma once
+#include <atomic>
 #include "board.h"
 #include "value.h"
 #include "timer.h"
@@ -24,24 +25,26 @@ struct SearchCfg
   MS inc[2]  = { Time::Inc, Time::Inc };
   bool infinite = false;
   int depth = Val::Inf;
+  int nodes = Val::Inf;
+  MS movetime = limits<MS>::max();
 
   // not supported by eia
   Move searchmoves = Move::None;
   bool ponder = false;
   int movestogo = Val::Inf;
-  int nodes = Val::Inf, mate = Val::Inf;
-  MS movetime = limits<i64>::max();
+  int mate = Val::Inf;
 };
 
 class Solver
 {
 protected:
-  mutable bool thinking = false;
+  mutable std::atomic<bool> thinking = false;
   mutable bool infinite = false;
   mutable bool verbose = true;
 
 public:
   Solver() {}
+  virtual ~Solver() = default;
 
   virtual bool is_solver() { return 0; }
   virtual void new_game() {}
@@ -51,7 +54,15 @@ public:
   virtual u64 perft(int depth) { return 0; }
   virtual int plegt() { return 0; }
   virtual int eval() { return 0; }
-  void stop() { thinking = false; }
+  virtual u64 get_nodes() const { return 0; }
+  virtual void set_threads(int count) {}
+  virtual void set_hash(MB size_mb) {}
+  virtual MB get_hash_mb() const { return 0; } // actually allocated
+  virtual void set_pk_hash(MB size_mb) {}
+  virtual u64 get_pk_probes() const { return 0; }
+  virtual u64 get_pk_hits() const { return 0; }
+  virtual void stop() { thinking = false; }
+  virtual void start_thinking() { thinking = true; } // called before get_move()
   void set_analysis(bool val) { infinite = val; }
   void set_verbosity(bool val) { verbose = val; }
 };
@@ -1,5 +1,6 @@
 #include <format>
 #include <iostream>
+#include <random>
 #include "solver_pvs.h"
 #include "hash.h"
 #include "eval.h"
@@ -16,16 +17,29 @@ const Val Futility_Margin[] = { 0_cp, 50_cp, 350_cp, 550_cp };
 // from Ethereal
 const int LMP_Depth = 8;
 
-SolverPVS::SolverPVS()
+// Lazy SMP helpers skip some iterations to spread over depths,
+//  the pattern was borrowed from Stockfish 10
+
+const int Skip_Size[]  = { 1, 1, 2, 2, 2, 2, 3, 3, 3, 3, 3, 3, 4, 4, 4, 4, 4, 4, 4, 4 };
+const int Skip_Phase[] = { 0, 1, 0, 1, 2, 3, 0, 1, 2, 3, 4, 5, 0, 1, 2, 3, 4, 5, 6, 7 };
+
+SolverPVS::SolverPVS(Table * shared, int id) : id(id), own_hash(!shared)
 {
   B = new Board;
-  H = new Hash::Table(HashTables::Size);
+  H = shared ? shared : new Hash::Table(HashTables::Size);
+  E = new Eval(eia::E[0]);
+  PK = new PK_Table;
+  EC = new Eval_Table;
+  E->attach(PK);
   init();
 }
 
 SolverPVS::~SolverPVS()
 {
-  delete H;
+  delete EC;
+  delete PK;
+  delete E;
+  if (own_hash) delete H;
   delete B;
 }
 
@@ -54,12 +68,12 @@ void SolverPVS::new_game()
 {
   best_val = 0_cp;
   max_ply = 0;
-  nodes = 0ull;
+  nodes.store(0ull, memory_order_relaxed);
   g_depth = 0;
 
-  H->clear();
-  undos[0].killer[0] = Move::None;
-  undos[0].killer[1] = Move::None;
+  E->set(eia::E[0]);
+  EC->clear();
+  if (own_hash) H->clear();
 
   for (int col = 0; col < 2; col++)
   {
@@ -71,21 +85,29 @@ void SolverPVS::new_game()
         history[col][0][1][i][j] = 0;
         history[col][1][0][i][j] = 0;
         history[col][1][1][i][j] = 0;
+        counter[col][i][j] = Move::None;
       }
     }
   }
+  if (id) shuffle_history();
 
   for (int i = 0; i < Limits::Plies; i++)
-    undos[i].excluded = Move::None;
+    undos[i] = Undo{}; // zero is Move::None
 }
 
 void SolverPVS::set(const Board & board)
 {
-  *B = board;
+  *B = board; // copy doesn't take states of other board
 }
 
 void SolverPVS::set_time(const SearchCfg & cfg)
 {
+  if (cfg.movetime != limits<MS>::max())
+  {
+    hard_bound = soft_bound = cfg.movetime;
+    return;
+  }
+
   Color we = B->to_move();
   int moves_left = std::max(25, 50 - B->moves_cnt / 2);
   MS time = cfg.time[we] - 50;
@@ -96,14 +118,28 @@ void SolverPVS::set_time(const SearchCfg & cfg)
 }
 
 Move SolverPVS::get_move(Timestamp move_start, const SearchCfg & cfg)
+{
+  if (own_hash) H->new_search();
+  Move best = think(move_start, cfg);
+
+  if (verbose) say<1>("bestmove {}\n", best);
+  return best;
+}
+
+Move SolverPVS::think(Timestamp move_start, const SearchCfg & cfg)
 {
   start = move_start;
   infinite = cfg.infinite;
   set_time(cfg);  
   max_ply = 0;
-  nodes = 0ull;
+  nodes.store(0ull, memory_order_relaxed);
+  max_nodes = cfg.nodes == Val::Inf ? limits<u64>::max() : cfg.nodes;
   g_depth = 0;
   best_val = 0_cp;
+  root_best = Move::None;
+  root_val = 0_cp;
+  root_depth = 0;
+  iters.clear();
 
   const int iters_soft = 6;
   Move bests[Limits::Plies + 1];
@@ -113,6 +149,7 @@ Move SolverPVS::get_move(Timestamp move_start, const SearchCfg & cfg)
     undos[i].excluded = Move::None;
 
   B->revert_states();
+  EC->reset_stats();
 
   MoveList ml;
   B->generate_legal(ml);
@@ -131,6 +168,8 @@ Move SolverPVS::get_move(Timestamp move_start, const SearchCfg & cfg)
 
   for (g_depth = 1; g_depth <= (std::min)(+Limits::Plies, cfg.depth); ++g_depth)
   {
+    if (skip_depth(g_depth)) continue;
+
     Val val = best_val = pvs<Root>(-Val::Inf, Val::Inf, g_depth);
     if (!thinking) break;
 
@@ -139,17 +178,23 @@ Move SolverPVS::get_move(Timestamp move_start, const SearchCfg & cfg)
     bests[g_depth] = best;
     vals[g_depth] = val;
 
+    root_best = best;
+    root_val = val;
+    root_depth = g_depth;
+    iters.push_back({ g_depth, best, val, get_nodes(), elapsed(start) });
+
     if (verbose)
     say<1>("info depth {} seldepth {} score {:o} nodes {} time {} pv {} hashfull {}\n",
-            g_depth, max_ply, val, nodes, elapsed(start), best, H->hashfull());
+            g_depth, max_ply, val, total_nodes(), elapsed(start), best, H->hashfull());
 
     if (val + cp(g_depth) >  Val::Inf) break;
     if (val - cp(g_depth) < -Val::Inf) break;
 
 
-    // checking soft time bound
+    // checking soft time bound (main thread decides)
 
     if (!infinite
+    &&  !id
     &&  elapsed(start) > soft_bound
     &&  g_depth > iters_soft)
     {
@@ -168,10 +213,65 @@ Move SolverPVS::get_move(Timestamp move_start, const SearchCfg & cfg)
     }
   }
 
-  if (verbose) say<1>("bestmove {}\n", best);
-  
+  if (verbose)
+  say<1>("info string eval cache {} probes {:.1f}% hits\n",
+          EC->get_probes(), 100.0 * EC->get_hits() / (EC->get_probes() + 1));
+
   thinking = false;
-  return is_empty(best) ? ml.get_next() : best;
+  if (is_empty(best) && ml.count()) best = ml.get_next();
+  if (is_empty(root_best)) root_best = best;
+  return best;
+}
+
+bool SolverPVS::skip_depth(int depth) const
+{
+  if (!id) return false;
+
+  const int i = (id - 1) % 20;
+  return ((depth + Skip_Phase[i]) / Skip_Size[i]) % 2;
+}
+
+// Helpers also get a bit of noise in quiet moves ordering
+//  so they don't walk exactly the same tree as the main thread,
+//  it's added once per game to cleared history
+
+void SolverPVS::shuffle_history()
+{
+  std::mt19937 gen(id);
+  std::uniform_int_distribution<int> distr(0, 63);
+
+  for (int col = 0; col < 2; col++)
+    for (int leave = 0; leave < 2; leave++)
+      for (int enter = 0; enter < 2; enter++)
+        for (SQ i = A1; i < SQ_N; ++i)
+          for (SQ j = A1; j < SQ_N; ++j)
+            history[col][leave][enter][i][j] += distr(gen);
+}
+
+// Static eval through the cache, lazy ones aren't stored there
+
+Val SolverPVS::evaluate(Val alpha, Val beta, bool & exact)
+{
+  const u64 key = B->hash();
+
+  Val val;
+  exact = true;
+  if (EC->probe(key, val)) return val;
+
+  val = E->eval(B, alpha, beta);
+  exact = !E->was_lazy();
+  if (exact) EC->store(key, val);
+  return val;
+}
+
+u64 SolverPVS::total_nodes() const
+{
+  if (!team) return get_nodes();
+
+  u64 count = 0ull;
+  for (auto worker : *team)
+    count += worker->get_nodes();
+  return count;
 }
 
 u64 SolverPVS::perft(int depth)
@@ -198,7 +298,7 @@ u64 SolverPVS::perft(int depth)
   Move move;
   while (!is_empty(move = mp.get_next()))
   {
-    if (!B->make(move)) continue;
+    B->make(move);
 
     say("{}", move);
 
@@ -240,7 +340,7 @@ u64 SolverPVS::perft_inner(int depth)
   Move move;
   while (!is_empty(move = mp.get_next()))
   {
-    if (!B->make(move)) continue;
+    B->make(move);
 
     count += depth > 1 ? perft_inner(depth - 1) : 1;
 
@@ -255,12 +355,10 @@ int SolverPVS::plegt()
   int false_pos = 0;
   int false_neg = 0;
 
-  MoveList pseudo, legal;
-  B->generate_all(pseudo);
+  MoveList legal;
   B->generate_legal(legal);
   say("{}", B->to_string());
 
-  say("Pseudo moves: {}\n", pseudo.count());
   say("Legal moves: {}\n\n", legal.count());
 
   string report;
@@ -268,16 +366,16 @@ int SolverPVS::plegt()
   for (u16 i = 0u; i < count; i++)
   {
     const Move move = static_cast<Move>(i);
-    const bool passed = B->pseudolegal(move);
+    const bool passed = B->pseudolegal(move) && B->legal(move);
     const Piece p = B->square[get_from(move)];
 
-    if (passed && !pseudo.contains(move)) // pseudolegality is enough
+    if (passed && !legal.contains(move)) // checks are too loose
     {
       false_pos++;
       report += format("!pos - 0x{:04X} : {} | {}\n", i, p, detailed(move));
     }
 
-    if (!passed && legal.contains(move)) // a narrower check 
+    if (!passed && legal.contains(move)) // checks are too strict
     {
       false_neg++;
       report += format("!neg - 0x{:04X} : {} | {}\n", i, p, detailed(move));
@@ -296,17 +394,10 @@ bool SolverPVS::abort() const
 {
   if (!thinking) return true;
 
-  if ((nodes & 8191) == 0 && Input.available())
+  if (g_depth > 1 && get_nodes() >= max_nodes)
   {
-    std::string str;
-    getline(cin, str);
-
-    if (str == "isready") say<1>("readyok");
-    if (str == "stop" || str == "quit")
-    {
-      thinking = false;
-      return true;
-    }
+    thinking = false;
+    return true;
   }
 
   if (infinite) return false;
@@ -319,6 +410,16 @@ bool SolverPVS::abort() const
   return false;
 }
 
+// Hash probes of the child are cache misses mostly,
+//  so memory is requested before make() does its work
+
+void SolverPVS::prefetch(Move move) const
+{
+  u64 pk_key;
+  H->prefetch(B->key_after(move, pk_key));
+  PK->prefetch(pk_key);
+}
+
 void SolverPVS::update_moves_stats(int depth)
 {
   Undo & undo = undos[ply()];
@@ -329,8 +430,8 @@ void SolverPVS::update_moves_stats(int depth)
   const SQ from = get_from(move);
   const SQ to = get_to(move);
 
-  const bool leave = B->state.threats & bit(from);
-  const bool enter = B->state.threats & bit(to);
+  const bool leave = B->threats() & bit(from);
+  const bool enter = B->threats() & bit(to);
 
   history[B->color][leave][enter][from][to] += depth * depth;
 
@@ -356,8 +457,8 @@ int SolverPVS::get_history(Move move) const
   const SQ from = get_from(move);
   const SQ to = get_to(move);
 
-  const bool leave = B->state.threats & bit(from);
-  const bool enter = B->state.threats & bit(to);
+  const bool leave = B->threats() & bit(from);
+  const bool enter = B->threats() & bit(to);
 
   return history[B->color][leave][enter][from][to];
 }
@@ -366,7 +467,6 @@ template<NodeType NT>
 Val SolverPVS::pvs(Val alpha, Val beta, int depth, bool is_null, bool is_singular)
 {
   using namespace Hash;
-  if constexpr (NT == Root) thinking = true;
 
   if (ply() >= Limits::Plies) return E->eval(B, alpha, beta);
 
@@ -377,7 +477,7 @@ Val SolverPVS::pvs(Val alpha, Val beta, int depth, bool is_null, bool is_singula
   Val best = -Val::Inf;
   Val alpha_ = alpha;
   undo.best = Move::None;
-  nodes++;
+  count_node();
 
   if (!in_check && depth <= 0) return qs(alpha, beta);
 
@@ -425,11 +525,13 @@ Val SolverPVS::pvs(Val alpha, Val beta, int depth, bool is_null, bool is_singula
     }
   }
 
-  Val eval = hash_eval  ? hash_eval : E->eval(B, alpha, beta);
+  bool exact = true;
+  Val eval = hash_eval  ? hash_eval : evaluate(alpha, beta, exact);
+  const Val tt_eval = exact ? eval : Val::Zero; // lazy one isn't kept
 
   if (!tt_hit && !in_check && !excluded) // +20 elo (20+.2s h2h-20)
   {
-    H->store(B->hash(), ply(), Move::None, Val::Zero, eval, 0, Type::None);
+    H->store(B->hash(), ply(), Move::None, Val::Zero, tt_eval, 0, Type::None);
   }
 
   undo.eval = eval;
@@ -551,7 +653,8 @@ Val SolverPVS::pvs(Val alpha, Val beta, int depth, bool is_null, bool is_singula
       }
     }
 
-    if (!B->make(move)) continue;
+    prefetch(move);
+    B->make(move);
 
     undo.curr = move;
     legal++;
@@ -589,7 +692,11 @@ Val SolverPVS::pvs(Val alpha, Val beta, int depth, bool is_null, bool is_singula
 
         B->make(hash_move);
 
-        if (abort()) return alpha;
+        if (abort())
+        {
+          B->unmake(hash_move);
+          return alpha;
+        }
 
         if (val < s_beta)
         {
@@ -689,7 +796,7 @@ Val SolverPVS::pvs(Val alpha, Val beta, int depth, bool is_null, bool is_singula
       auto bound = best >= beta  ? Hash::Lower
                  : best > alpha_ ? Hash::Exact : Hash::Upper;
       Move bm = bound == Upper ? Move::None : undo.best;
-      H->store(B->hash(), ply(), bm, best, eval, depth, bound);
+      H->store(B->hash(), ply(), bm, best, tt_eval, depth, bound);
     }
   }
   return best;
@@ -725,10 +832,11 @@ Val SolverPVS::qs(Val alpha, Val beta)
 
   // 2. Calculating stand pat
 
+  bool exact = true;
   Val eval = in_check ? cp(ply()) - Val::Inf
-           : hash_eval ? hash_eval : E->eval(B, alpha, beta);
+           : hash_eval ? hash_eval : evaluate(alpha, beta, exact);
 
-  if (!tt_hit && !in_check) // ?? elo (20+.2s h2h-20)
+  if (!tt_hit && !in_check && exact) // ?? elo (20+.2s h2h-20)
   {
     H->store(B->hash(), ply(), Move::None, Val::Zero, eval, 0, Type::None);
   }
@@ -750,14 +858,15 @@ Val SolverPVS::qs(Val alpha, Val beta)
   Move move;
   while (!is_empty(move = mp.get_next(false)))
   {
-    if (!B->make(move)) continue;
+    prefetch(move);
+    B->make(move);
 
     // SEE pruning (+70 elo 10s+.1 h2h-30)
     if (!in_check
     &&  !is_prom(move)
     &&  B->see(move) < 0) continue;
 
-    nodes++;
+    count_node();
     undo.curr = move;
 
     Val val = -qs(-beta, -alpha);
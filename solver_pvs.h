@@ -1,4 +1,6 @@
 #pragma once
+#include <atomic>
+#include <vector>
 #include "movepicker.h"
 #include "board.h"
 #include "solver.h"
@@ -10,6 +12,17 @@ using namespace Hash;
 
 enum NodeType { PV, NonPV, Root };
 
+struct Iteration // completed one
+{
+  int depth;
+  Move best;
+  Val val;
+  u64 nodes;
+  MS time;
+};
+
+class Eval;
+
 class SolverPVS : public Solver
 {
   Timestamp start;
@@ -18,27 +31,52 @@ class SolverPVS : public Solver
   Undo undos[Limits::Plies];
   Board * B;
   Table * H;
+  Eval * E;
+  PK_Table * PK;
+  Eval_Table * EC;
   Counter counter;
   History history;
 
+  int id;        // 0 - main thread, others are helpers
+  bool own_hash; // shared table is cleared by its owner
+  const std::vector<SolverPVS *> * team = nullptr;
+
   int max_ply;
-  u64 nodes;
+  std::atomic<u64> nodes; // written by own thread, read by team
+  u64 max_nodes; // per worker
   int g_depth;
   Val best_val;
 
+  Move root_best; // results of the last completed iteration
+  Val  root_val;
+  int  root_depth;
+  std::vector<Iteration> iters;
+
   MS soft_bound;
   MS hard_bound;
 
 public:
-  SolverPVS();
+  SolverPVS(Table * shared = nullptr, int id = 0);
   ~SolverPVS();
   void init();
   bool is_solver() { return true; }
   void new_game();
   void set(const Board & board) override;
   Move get_move(Timestamp start, const SearchCfg & cfg) override;
+  Move think(Timestamp start, const SearchCfg & cfg);
   int  get_best_val() const { return best_val; }
 
+  void set_team(const std::vector<SolverPVS *> * workers) { team = workers; }
+  u64 get_nodes() const override { return nodes.load(std::memory_order_relaxed); }
+  u64 total_nodes() const;
+  void set_pk_hash(MB size_mb) override { PK->init(size_mb); }
+  u64 get_pk_probes() const override { return PK->get_probes(); }
+  u64 get_pk_hits() const override { return PK->get_hits(); }
+  Move get_root_best() const { return root_best; }
+  Val  get_root_val() const { return root_val; }
+  int  get_root_depth() const { return root_depth; }
+  const std::vector<Iteration> & get_iters() const { return iters; }
+
   u64 get_hash() const { return B->state.bhash; }
   void make(Move move) override
   {
@@ -53,6 +91,11 @@ public:
   int plegt();
 
   bool abort() const;
+  void prefetch(Move move) const;
+  void count_node() // single writer, no locked add needed
+  {
+    nodes.store(nodes.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+  }
   int ply() const { return B->ply(); }
   Val contempt() const { return 0_cp; }
 
@@ -70,6 +113,9 @@ public:
 
 private:
   void set_time(const SearchCfg & cfg);
+  bool skip_depth(int depth) const;
+  void shuffle_history();
+  Val evaluate(Val alpha, Val beta, bool & exact);
 };
 
 
@@ -77,7 +123,7 @@ template<bool QS>
 void SolverPVS::set_movepicker(MovePicker<QS> & mp, Move hash)
 {
   const Undo & undo = undos[ply()];
-  const bool hash_correct = B->pseudolegal(hash);
+  const bool hash_correct = B->pseudolegal(hash) && B->legal(hash);
 
   mp.ml.clear();
 
@@ -96,10 +142,4 @@ void SolverPVS::set_movepicker(MovePicker<QS> & mp, Move hash)
              : counter[~B->color][get_from(prev)][get_to(prev)];
 }
 
-
-// explicit instantiate for use in cpp leads to better compile time
-template Val SolverPVS::pvs<PV>(Val alpha, Val beta, int depth, bool is_null, bool is_singular);
-template Val SolverPVS::pvs<NonPV>(Val alpha, Val beta, int depth, bool is_null, bool is_singular);
-template Val SolverPVS::pvs<Root>(Val alpha, Val beta, int depth, bool is_null, bool is_singular);
-
 }
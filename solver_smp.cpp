@@ -0,0 +1,172 @@
+#include <unordered_map>
+#include <algorithm>
+#include <thread>
+#include "solver_smp.h"
+
+using namespace std;
+
+namespace eia {
+
+SolverSMP::SolverSMP(int threads)
+{
+  H = new Hash::Table(HashTables::Size);
+  set_threads(threads);
+}
+
+SolverSMP::~SolverSMP()
+{
+  for (auto worker : workers) delete worker;
+  delete H;
+}
+
+void SolverSMP::set_threads(int count)
+{
+  const size_t n = std::clamp(count, 1, +Limits::Threads);
+
+  while (workers.size() > n)
+  {
+    delete workers.back();
+    workers.pop_back();
+  }
+
+  while (workers.size() < n)
+  {
+    const int id = static_cast<int>(workers.size());
+    auto worker = new SolverPVS(H, id);
+    worker->set_pk_hash(pk_size);
+    worker->new_game();
+    worker->set(root);
+    worker->set_verbosity(false);
+    worker->set_team(&workers);
+    workers.emplace_back(worker);
+  }
+
+  main()->set_verbosity(verbose);
+}
+
+void SolverSMP::set_hash(MB size_mb)
+{
+  H->init(size_mb, static_cast<int>(workers.size()));
+}
+
+// Pawn hash is own for each worker, so the size is per thread
+
+void SolverSMP::set_pk_hash(MB size_mb)
+{
+  pk_size = size_mb;
+  for (auto worker : workers) worker->set_pk_hash(size_mb);
+}
+
+u64 SolverSMP::get_pk_probes() const
+{
+  u64 count = 0ull;
+  for (auto worker : workers) count += worker->get_pk_probes();
+  return count;
+}
+
+u64 SolverSMP::get_pk_hits() const
+{
+  u64 count = 0ull;
+  for (auto worker : workers) count += worker->get_pk_hits();
+  return count;
+}
+
+void SolverSMP::new_game()
+{
+  H->clear(static_cast<int>(workers.size()));
+  for (auto worker : workers) worker->new_game();
+}
+
+void SolverSMP::set(const Board & board)
+{
+  root = board;
+  for (auto worker : workers) worker->set(root);
+}
+
+void SolverSMP::make(Move move)
+{
+  root.make(move);
+  root.revert_states();
+  for (auto worker : workers) worker->make(move);
+}
+
+void SolverSMP::start_thinking()
+{
+  thinking = true;
+  for (auto worker : workers) worker->start_thinking();
+}
+
+void SolverSMP::stop()
+{
+  thinking = false;
+  for (auto worker : workers) worker->stop();
+}
+
+Move SolverSMP::get_move(Timestamp start, const SearchCfg & cfg)
+{
+  H->new_search();
+  main()->set_verbosity(verbose);
+
+  vector<thread> helpers;
+  for (size_t i = 1; i < workers.size(); i++)
+  {
+    SolverPVS * worker = workers[i];
+    helpers.emplace_back([=]() { worker->think(start, cfg); });
+  }
+
+  main()->think(start, cfg);
+
+  for (size_t i = 1; i < workers.size(); i++) workers[i]->stop();
+  for (auto & helper : helpers) helper.join();
+
+  Move best = vote();
+  if (verbose) say<1>("bestmove {}\n", best);
+
+  thinking = false;
+  return best;
+}
+
+// Each worker votes for its best move proportionally to depth
+//  and to the score advantage over the worst worker (as in Ethereal),
+//  the shortest found mate is taken regardless of votes
+
+Move SolverSMP::vote() const
+{
+  SolverPVS * best = main();
+  if (workers.size() == 1 || !best->get_root_depth())
+    return best->get_root_best();
+
+  Val worst = Val::Inf;
+  for (auto worker : workers)
+    if (worker->get_root_depth())
+      worst = (std::min)(worst, worker->get_root_val());
+
+  unordered_map<Move, i64> votes;
+  for (auto worker : workers)
+    if (worker->get_root_depth())
+    {
+      const i64 margin = dry(worker->get_root_val() - worst) + 20;
+      votes[worker->get_root_best()] += margin * worker->get_root_depth();
+    }
+
+  for (auto worker : workers)
+  {
+    if (!worker->get_root_depth()) continue;
+
+    const Val val = worker->get_root_val();
+    const Move move = worker->get_root_best();
+
+    if (is_win(val) || is_win(best->get_root_val()))
+    {
+      if (val > best->get_root_val()) best = worker;
+    }
+    else if (votes[move] > votes[best->get_root_best()])
+    {
+      best = worker;
+    }
+  }
+
+  return best->get_root_best();
+}
+
+}
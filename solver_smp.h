@@ -0,0 +1,43 @@
+#pragma once
+#include <vector>
+#include "solver_pvs.h"
+
+namespace eia {
+
+// Lazy SMP - workers are common PVS solvers that talk
+//  to each other only through the shared hash table
+
+class SolverSMP : public Solver
+{
+  Table * H;
+  MB pk_size = HashTables::PK_Size;
+  Board root;
+  std::vector<SolverPVS *> workers;
+
+public:
+  SolverSMP(int threads = 1);
+  ~SolverSMP();
+
+  bool is_solver() override { return true; }
+  void new_game() override;
+  void set(const Board & board) override;
+  Move get_move(Timestamp start, const SearchCfg & cfg) override;
+  void make(Move move) override;
+  u64 perft(int depth) override { return main()->perft(depth); }
+  int plegt() override { return main()->plegt(); }
+  u64 get_nodes() const override { return main()->total_nodes(); }
+  void set_threads(int count) override;
+  void set_hash(MB size_mb) override;
+  MB get_hash_mb() const override { return H->size_mb(); }
+  void set_pk_hash(MB size_mb) override;
+  u64 get_pk_probes() const override;
+  u64 get_pk_hits() const override;
+  void start_thinking() override;
+  void stop() override;
+
+private:
+  SolverPVS * main() const { return workers[0]; }
+  Move vote() const;
+};
+
+}
@@ -1,6 +1,7 @@
 #pragma once
 #include <format>
 #include <string>
+#include <string_view>
 #include <utility>
 #include <iostream>
 #include <algorithm>
@@ -28,7 +29,7 @@ INLINE SQ to_sq(int f, int r)
   return static_cast<SQ>((r << 3) + f);
 }
 
-INLINE SQ to_sq(std::string s)
+INLINE SQ to_sq(std::string_view s)
 {
   return s.length() > 1 ? to_sq(s[0] - 'a', s[1] - '1') : SQ_N;
 }
@@ -137,6 +137,27 @@ const std::array<SQ_BB, SQ_N + 1> between = []
   return result;
 }();
 
+// whole line through both squares, from edge to edge
+
+const std::array<SQ_BB, SQ_N + 1> line = []
+{
+  std::array<SQ_BB, SQ_N + 1> result{};
+  for (SQ i = A1; i < SQ_N; ++i)
+  {
+    for (SQ j = A1; j < SQ_N; ++j)
+    {
+      const int dt = on_line(i, j);
+      if (!dt) continue;
+
+      result[i][j] = Bit << i;
+      for (SQ k = A1; k < SQ_N; ++k)
+        if (on_line(i, k) == dt || on_line(i, k) == -dt)
+          result[i][j] |= Bit << k;
+    }
+  }
+  return result;
+}();
+
 const std::array<SQ_BB, Color_N> front_one = []
 {
   std::array<SQ_BB, Color_N> result{};
@@ -24,6 +24,7 @@ extern const std::array<SQ_BB, Piece_N> atts;
 extern const std::array<SQ_BB, Color_N> pmov;
 extern const std::array<SQ_Val, SQ_N + 1> dir;
 extern const std::array<SQ_BB, SQ_N + 1> between;
+extern const std::array<SQ_BB, SQ_N + 1> line;
 extern const std::array<SQ_BB, Color_N> front_one;
 extern const std::array<SQ_BB, Color_N> front;
 extern const std::array<SQ_BB, Color_N> fwd;
@@ -1,11 +1,15 @@
 #ifdef TUNING
+#include <cstring>
 #include <fstream>
+#include <filesystem>
 #include <utility>
 #include <algorithm>
 #include <omp.h>
 #include "epd.h"
 #include "tuning.h"
 #include "engine.h"
+#include "timer.h"
+#include "simd.h"
 
 using namespace std;
 
@@ -16,6 +20,14 @@ namespace eia {
 // --------------------------------------------------------------------
 
 bool DataProvider::open(string file)
+{
+  return scan(file, [&](string_view fen, int result)
+  {
+    poss.push_back({ string(fen), result });
+  });
+}
+
+bool DataProvider::scan(string file, const Callback & fn)
 {
   auto parts = split(file, ".");
   if (parts.size() < 2)
@@ -26,10 +38,17 @@ bool DataProvider::open(string file)
 
   std::string ext = parts[parts.size() - 1];
 
+  size_t count = 0;
+  auto counted = [&](string_view fen, int result)
+  {
+    fn(fen, result);
+    count++;
+  };
+
   if (ext == "csv")
   {
     log("Reading csv...\n");
-    if (!open_csv(file))
+    if (!scan_csv(file, counted))
     {
       log("Error in reading file\n");
       return false;
@@ -38,7 +57,7 @@ bool DataProvider::open(string file)
   else if (ext == "epd")
   {
     log("Reading epd...\n");
-    if (!open_epd(file))
+    if (!scan_epd(file, counted))
     {
       log("Error in reading file\n");
       return false;
@@ -47,14 +66,14 @@ bool DataProvider::open(string file)
   else if (ext == "book")
   {
     log("Reading book...\n");
-    if (!open_book(file))
+    if (!scan_book(file, counted))
     {
       log("Error in reading file\n");
       return false;
     }
   }
 
-  if (poss.size() < 1)
+  if (count < 1)
   {
     log("There is no any position in dataset\n");
     return false;
@@ -63,60 +82,53 @@ bool DataProvider::open(string file)
   return true;
 }
 
-bool DataProvider::open_csv(string file)
+bool DataProvider::scan_csv(string file, const Callback & fn)
 {
-  ifstream f_csv(file);
-  if (!f_csv.is_open()) return false;
+  LineReader reader;
+  if (!reader.open(file)) return false;
 
-  string line;
-  while (f_csv)
+  for (string_view line; reader.next(line);)
   {
-    getline(f_csv, line);
-    string fen = cut(line, ";");
-    string eval = cut(line, ";");
+    string_view fen = cut(line, ";");
+    string_view eval = cut(line, ";");
     int result = parse_int(line); // eval?
 
-    poss.push_back({ fen, result });
+    if (fen.empty()) continue;
+
+    fn(fen, result);
   }
   return true;
 }
 
-bool DataProvider::open_epd(string file)
+bool DataProvider::scan_epd(string file, const Callback & fn)
 {
-  Epd epd;
-  if (!epd.read(file)) return false;
-
-  const auto & problems = epd.get_problems();
-  for (const auto & p : problems)
+  return Epd::scan(file, [&](const Problem & p)
   {
-    if (!p.valid) continue;
+    if (!p.valid) return;
 
-    const string & result = p.comment[9];
+    const string_view result = p.comment[9];
     const int r = result.starts_with("1-0")
                 - result.starts_with("0-1");
 
-    poss.push_back({ p.fen, r });
-  }
-  return true;
+    fn(p.fen, r);
+  });
 }
 
-bool DataProvider::open_book(string file)
+bool DataProvider::scan_book(string file, const Callback & fn)
 {
-  ifstream f_book(file);
-  if (!f_book.is_open()) return false;
+  LineReader reader;
+  if (!reader.open(file)) return false;
 
-  string line;
-  while (f_book)
+  for (string_view line; reader.next(line);)
   {
-    getline(f_book, line);
-    string fen = cut(line, "[");
-    string eval = cut(line, "]");
+    string_view fen = cut(line, "[");
+    string_view eval = cut(line, "]");
     int result = eval.starts_with("1.0")
                - eval.starts_with("0.0");
 
     if (fen.empty()) continue;
 
-    poss.push_back({ fen, result });
+    fn(fen, result);
   }
   return true;
 }
@@ -163,47 +175,65 @@ PSTMatResult PSTMatConverter::convert(const PosResult & pr) const
 
 // TunerStatic /////////////////////////////////
 
+// Each thread has own board and eval with trace, gradients
+//  are accumulated only for params present in position
+
 Score TunerStatic::score(const Tune & v, double k0)
 {
   const double k = k0 ? k0 : Tunes::K100;
   const size_t total = size();
   const size_t N = batch_n();
 
-  Tune grad{};
-  double loss = 0.0;
+  if (evals.size() != threads)
+  {
+    boards.resize(threads);
+    evals.clear();
+    for (int i = 0; i < threads; i++) evals.emplace_back(make_unique<Eval>());
+  }
 
-  E->set(v);
+  vector<Tune> local_grad(threads);
+  double loss = 0.0;
 
-  for (int i = 0; i < N; i++)
+  #pragma omp parallel num_threads(threads) reduction(+:loss)
   {
-    const auto & pos = poss[(index + i) % total];
-    B.set(pos.fen);
-    Val val = E->eval(&B, -Val::Inf, Val::Inf, false);
-    const Trace & trace = E->get_trace();
+    const int tid = omp_get_thread_num();
+    Board & B = boards[tid];
+    Eval & eval = *evals[tid];
+    eval.set(v);
 
-    const double r = B.color ? pos.result : -pos.result;
-    const double y = (r + 1) / 2.0;
-    const double s = sigmoid(dry_double(val), k);
+    #pragma omp for schedule(static)
+    for (int i = 0; i < N; i++)
+    {
+      const auto & pos = poss[(index + i) % total];
+      B.set(pos.fen);
+      Val val = eval.eval(&B, -Val::Inf, Val::Inf, false);
+      const Trace & trace = eval.get_trace();
 
-    loss += L->f(y, s);
-    grad += L->df(y, s) * calc_dE(trace);
+      const double r = B.color ? pos.result : -pos.result;
+      const double y = (r + 1) / 2.0;
+      const double s = sigmoid(dry_double(val), k);
+
+      loss += L->f(y, s);
+      update_grad(local_grad[tid], L->df(y, s), trace);
+    }
   }
 
+  Tune grad = reduce(local_grad, threads);
+
   loss /= N;
   grad /= N;
 
   return Score(loss, grad);
 }
 
-Tune TunerStatic::calc_dE(const Trace & T) const
+void TunerStatic::update_grad(Tune & grad, double df, const Trace & T) const
 {
-  Tune dE;
   for (int i = 0; i < Param_N; i++)
   {
-    dE.param[i][0] = T.factor[0] * T.amount[i];
-    dE.param[i][1] = T.factor[1] * T.amount[i];
+    if (!T.amount[i]) continue;
+    grad.param[i][0] += df * T.factor[0] * T.amount[i];
+    grad.param[i][1] += df * T.factor[1] * T.amount[i];
   }
-  return dE;
 }
 
 
@@ -212,41 +242,109 @@ Tune TunerStatic::calc_dE(const Trace & T) const
 Score TunerCached::score(const Tune & v, double k0)
 {
   const double k = k0 ? k0 : Tunes::K100;
-  const size_t N = size();
+  std::span<const int> batch(order.data() + index, batch_n());
+  Score s = pass(v, k, batch, true);
+
+  // regularization
+  s.loss += scalar_mult(v, v) * Lambda / 2;
+  s.grad += Lambda * v;
+
+  return s;
+}
+
+double TunerCached::validate(const Tune & v, double k0)
+{
+  const double k = k0 ? k0 : Tunes::K100;
+  return valid.empty() ? 0. : pass(v, k, valid, false).loss;
+}
+
+// Mini-batches go one by one over training indices, they are
+//  shuffled again when no full batch is left (the tail is
+//  dropped this epoch and gets its turn in other ones)
 
-  Tune   local_grad[MaxThreads]{};
-  double local_loss[MaxThreads]{};
+void TunerCached::next_iter()
+{
+  if (!batch_sz) return;
 
-  #pragma omp parallel for schedule(static) num_threads(2)
-  for (int i = 0; i < N; i++)
+  index += (int)batch_n();
+  if (index + batch_n() > order.size())
   {
-    const int tid = omp_get_thread_num();
-    const double val = calc_eval(v, i);
+    std::shuffle(order.begin(), order.end(), gen);
+    index = 0;
+  }
+}
 
-    const double y = posis[i].wdl;
-    const double s = sigmoid(val, k);
-    const double df = L->df(y, s);
+void TunerCached::split()
+{
+  vector<int> ids(size());
+  for (int i = 0; i < ids.size(); i++) ids[i] = i;
+  if (batch_sz || valid_part > 0) std::shuffle(ids.begin(), ids.end(), gen);
+
+  const size_t valid_n = static_cast<size_t>(ids.size() * valid_part);
+  valid.assign(ids.end() - valid_n, ids.end());
+  order.assign(ids.begin(), ids.end() - valid_n);
+  index = 0;
+}
 
-    local_loss[tid] += L->f(y, s);
-    update_grad(local_grad[tid], df, i);
+Score TunerCached::pass(const Tune & v, double k, std::span<const int> ids, bool grads) const
+{
+  const int N = (int)ids.size();
+
+  // Params go as float op/eg pairs to gather them by index at
+  //  once. Gradients of thread are summed in float buffer and
+  //  flushed to double ones now and then to not lose precision,
+  //  they are added up pairwise after all
+
+  vector<float> w(2 * Param_N);
+  for (int j = 0; j < Param_N; j++)
+  {
+    w[2 * j + 0] = static_cast<float>(v.param[j][0]);
+    w[2 * j + 1] = static_cast<float>(v.param[j][1]);
   }
 
-  Tune grad{};
+  vector<Tune> local_grad(grads ? threads : 0);
   double loss = 0.0;
 
-  for (int i = 0; i < MaxThreads; i++)
+  #pragma omp parallel num_threads(threads) reduction(+:loss)
   {
-    loss += local_loss[i];
-    grad += local_grad[i];
+    vector<float> buf(grads ? 2 * Param_N : 0);
+    int pending = 0;
+
+    auto flush = [&]()
+    {
+      if (!grads) return;
+      Tune & grad = local_grad[omp_get_thread_num()];
+      for (int j = 0; j < Param_N; j++)
+      {
+        grad.param[j][0] += buf[2 * j + 0];
+        grad.param[j][1] += buf[2 * j + 1];
+      }
+      std::fill(buf.begin(), buf.end(), 0.f);
+      pending = 0;
+    };
+
+    #pragma omp for schedule(static)
+    for (int n = 0; n < N; n++)
+    {
+      const int i = ids[n];
+      const double val = calc_eval(w.data(), i);
+
+      const double y = posis[i].wdl;
+      const double s = sigmoid(val, k);
+
+      loss += L->f(y, s);
+      if (!grads) continue;
+
+      update_grad(buf.data(), L->df(y, s), i);
+      if (++pending == Flush_N) flush();
+    }
+    flush();
   }
 
+  Tune grad = grads ? reduce(local_grad, threads) : Tune{};
+
   loss /= N;
   grad /= N;
-
-  // regularization
-  loss += scalar_mult(v, v) * Lambda / 2;
-  grad += Lambda * v;
-
   return Score(loss, grad);
 }
 
@@ -254,45 +352,62 @@ bool TunerCached::open(string file)
 {
   const int show_n = (1 << 15) - 1;
 
-  vector<PosResult> poss;
-  if (!DataProvider(poss).open(file)) return false;
+  if (load_cache(file))
+  {
+    log("Traces are mapped from {}.cache\n\n", file);
+    split();
+    return true;
+  }
 
-  log("Total: {} positions\n\n", poss.size());
   log("Collecting eval traces...\n");
 
-  posis.resize(poss.size());
+  own_posis.clear();
+  own_indices.clear();
+  own_values.clear();
   const Tune v = E->to_tune();
   //log("used tune: {}\n", v);
 
-  int offset = 0;
-  for (int j = 0; j < poss.size(); j++)
+  // Positions go straight from the file to board
+
+  i64 offset = 0;
+  auto collect = [&](string_view fen, int result)
   {
-    const auto & pos = poss[j];
-    if (!(j & show_n)) log("{}", progress(1. * j / poss.size()));
+    const int j = static_cast<int>(own_posis.size());
+    if (!(j & show_n)) log("\r{} positions", j);
 
-    B.set(pos.fen);
+    B.set(fen);
     Val val = E->eval(&B, -Val::Inf, Val::Inf, false);
     double y = B.color ? dry_double(val) : -dry_double(val);
-    const float wdl = (pos.result + 1) / 2.f;
+    const float wdl = (result + 1) / 2.f;
     const Trace T = E->get_trace();
-    posis[j] = { offset, 0, B.color, T.factor[0], T.factor[1], wdl, 0.f };
+    own_posis.push_back({ offset, 0, B.color, T.factor[0], T.factor[1], wdl, 0.f });
+    PosIndex & P = own_posis.back();
 
     int size = 0;
     for (int i = 0; i < Param_N; i++)
     {
       if (abs(T.amount[i]) > 1e-6)
       {
-        amounts.push_back({i, T.amount[i]});
+        own_indices.push_back(i);
+        own_values.push_back(T.amount[i]);
         size++;
       }
     }
 
-    posis[j].size = size;
-    posis[j].rest = y - calc_eval(v, j);
+    P.size = size;
+    posis = own_posis; // vectors move as they grow
+    indices = own_indices;
+    values = own_values;
+    P.rest = y - calc_eval(v, j);
 
     offset += size;
-  }
-  log("{}\n\n", progress(1.));
+  };
+
+  if (!DataProvider::scan(file, collect)) return false;
+  log("\rTotal: {} positions\n\n", own_posis.size());
+
+  if (save_cache(file)) log("Traces are saved to {}.cache\n\n", file);
+  split();
 
   // Testing eval linearity
 
@@ -304,12 +419,14 @@ bool TunerCached::open(string file)
   //E->set(w);
 
   double max_err = 0;
-  for (int j = 0; j < poss.size(); j++)
+  int j = 0;
+  bool linear = true;
+  DataProvider::scan(file, [&](string_view fen, int result)
   {
-    const auto & pos = poss[j];
-    if (!(j & show_n)) log("{}", progress(1. * j / poss.size()));
+    if (!linear) return;
+    if (!(j & show_n)) log("{}", progress(1. * j / size()));
 
-    B.set(pos.fen);
+    B.set(fen);
     Val val = E->eval(&B, -Val::Inf, Val::Inf, false);
     const double y = B.color ? dry_double(val) : -dry_double(val);
     const double t = calc_eval(w, j);
@@ -323,7 +440,7 @@ bool TunerCached::open(string file)
 
       log("\n\n");
       log("{}\n", B.to_string());
-      log("{}\n", pos.fen);
+      log("{}\n", fen);
       log("Incorrect eval!\n");
       log("Original: {}\n", y);
       log("Calculated: {}\n", t);
@@ -337,25 +454,124 @@ bool TunerCached::open(string file)
       //__debugbreak();
       //const double tt = calc_eval(w, j, true);
 
-      return false;
+      linear = false;
     }
-  }
+    j++;
+  });
+  if (!linear) return false;
+
   log("{}\n\n", progress(1.));
   log("Max error: {}\n\n", max_err);
 
   return true;
 }
 
+bool CacheHeader::fits(const CacheHeader & h) const
+{
+  return !memcmp(magic, h.magic, sizeof(magic))
+      && version   == h.version
+      && param_n   == h.param_n
+      && posi_sz   == h.posi_sz
+      && amount_sz == h.amount_sz
+      && source_sz == h.source_sz
+      && source_time == h.source_time
+      && source_hash == h.source_hash
+      && eval_key  == h.eval_key;
+}
+
+// Key of eval is FNV-1a over names of terms and params
+//  as traces and rests are computed with both of them.
+// Dataset is hashed only by its first and last 4 KB,
+//  edits in the middle are left to size and write time
+
+CacheHeader TunerCached::cache_header(string file) const
+{
+  CacheHeader header;
+
+  error_code ec;
+  header.source_sz = filesystem::file_size(file, ec);
+  if (ec) header.source_sz = 0;
+  const auto time = filesystem::last_write_time(file, ec);
+  if (!ec) header.source_time = time.time_since_epoch().count();
+
+  u64 key = 0xCBF29CE484222325ull;
+  auto mix = [&](const void * data, size_t size)
+  {
+    auto bytes = static_cast<const u8 *>(data);
+    for (size_t i = 0; i < size; i++)
+      key = (key ^ bytes[i]) * 0x100000001B3ull;
+  };
+
+  const size_t edge = std::min<u64>(header.source_sz, 4096);
+  string buf(edge, '\0');
+  ifstream in(file, ios::binary);
+  in.read(buf.data(), edge);
+  mix(buf.data(), in.gcount());
+  in.seekg(header.source_sz - edge);
+  in.read(buf.data(), edge);
+  mix(buf.data(), in.gcount());
+  header.source_hash = key;
+
+  key = 0xCBF29CE484222325ull;
+  for (const string & name : term_str) mix(name.data(), name.size());
+  const Tune v = E->to_tune();
+  mix(v.param, sizeof(v.param));
+
+  header.eval_key = key;
+  return header;
+}
+
+bool TunerCached::load_cache(string file)
+{
+  if (!cache.open(file + ".cache")) return false;
+
+  CacheHeader header;
+  if (cache.size() < sizeof(header)) return false;
+  memcpy(&header, cache.get(), sizeof(header));
+
+  const size_t posis_bytes = header.posi_n * sizeof(PosIndex);
+  const size_t indices_bytes = header.amount_n * sizeof(i32);
+  const size_t values_bytes = header.amount_n * sizeof(float);
+
+  if (!header.fits(cache_header(file))
+  ||  cache.size() != sizeof(header) + posis_bytes + indices_bytes + values_bytes)
+  {
+    log("Cache {}.cache is outdated\n", file);
+    cache.close();
+    return false;
+  }
+
+  const char * data = cache.get() + sizeof(header);
+  posis = { reinterpret_cast<const PosIndex *>(data), header.posi_n };
+  indices = { reinterpret_cast<const i32 *>(data + posis_bytes), header.amount_n };
+  values = { reinterpret_cast<const float *>(data + posis_bytes + indices_bytes), header.amount_n };
+  return true;
+}
+
+bool TunerCached::save_cache(string file) const
+{
+  CacheHeader header = cache_header(file);
+  header.posi_n = posis.size();
+  header.amount_n = indices.size();
+
+  ofstream out(file + ".cache", ios::binary);
+  out.write(reinterpret_cast<const char *>(&header), sizeof(header));
+  out.write(reinterpret_cast<const char *>(posis.data()), posis.size_bytes());
+  out.write(reinterpret_cast<const char *>(indices.data()), indices.size_bytes());
+  out.write(reinterpret_cast<const char *>(values.data()), values.size_bytes());
+  return !!out;
+}
+
 // White's perspective position eval
 double TunerCached::calc_eval(const Tune & v, int pos_idx) const
 {
   const auto & P = posis[pos_idx];
   double op = 0., eg = 0.;
 
-  for (int i = P.offset; i < P.offset + P.size; i++)
+  for (i64 i = P.offset; i < P.offset + P.size; i++)
   {
-    const int j = amounts[i].index;
-    const double amount = amounts[i].val;
+    const int j = indices[i];
+    const double amount = values[i];
     op += v.param[j][0] * amount;
     eg += v.param[j][1] * amount;
   }
@@ -365,30 +581,44 @@ double TunerCached::calc_eval(const Tune & v, int pos_idx) const
   return mixed + (P.color ? dry_double(Tempo) : -dry_double(Tempo));
 }
 
+// The same with params as float op/eg pairs for vector kernel
+double TunerCached::calc_eval(const float * w, int pos_idx) const
+{
+  const auto & P = posis[pos_idx];
+  const auto [op, eg] = Simd::sparse_dot(w, &indices[P.offset], &values[P.offset], P.size);
+
+  const double mixed = op * P.factor[OP] + eg * P.factor[EG] + P.rest;
+
+  return mixed + (P.color ? dry_double(Tempo) : -dry_double(Tempo));
+}
+
 Tune TunerCached::calc_dE(const Tune & v, int pos_idx) const
 {
   const auto & P = posis[pos_idx];
   Tune dE{};
 
-  for (int i = P.offset; i < P.offset + P.size; i++)
+  for (i64 i = P.offset; i < P.offset + P.size; i++)
   {
-    const int j = amounts[i].index;
-    const double amount = amounts[i].val;
+    const int j = indices[i];
+    const double amount = values[i];
     dE.param[j][0] = (double)P.factor[0] * amount;
     dE.param[j][1] = (double)P.factor[1] * amount;
   }
   return dE;
 }
 
-void TunerCached::update_grad(Tune & grad, double df, int pos_idx) const
+// Gradient goes to float op/eg pairs as params in kernel
+void TunerCached::update_grad(float * grad, double df, int pos_idx) const
 {
   const auto & P = posis[pos_idx];
-  for (int i = P.offset; i < P.offset + P.size; i++)
+  const float d_op = static_cast<float>(df * P.factor[0]);
+  const float d_eg = static_cast<float>(df * P.factor[1]);
+
+  for (i64 i = P.offset; i < P.offset + P.size; i++)
   {
-    const int j = amounts[i].index;
-    const double amount = amounts[i].val;
-    grad.param[j][0] += df * (double)P.factor[0] * amount;
-    grad.param[j][1] += df * (double)P.factor[1] * amount;
+    const int j = indices[i];
+    grad[2 * j + 0] += d_op * values[i];
+    grad[2 * j + 1] += d_eg * values[i];
   }
 }
 
@@ -519,14 +749,13 @@ void SPSA::start()
 
 
 AdaGrad::AdaGrad(std::unique_ptr<Tuner> tuner,
-                 double learning_rate, double eps)
-  : tuner(move(tuner)), lrate(learning_rate), eps(eps)
+                 double learning_rate, double eps, int max_epochs)
+  : tuner(move(tuner)), lrate(learning_rate), eps(eps), epochs(max_epochs)
 {}
 
 void AdaGrad::start()
 {
-  const int iters = (int)tuner->size();
-  const int batches = iters / (int)tuner->batch_n();
+  const int batches = (int)(tuner->train_n() / tuner->batch_n());
 
   log("-- Starting eval tuning (AdaGrad)\n\n");
   log("Total parameters: {}\n", Param_N);
@@ -537,16 +766,17 @@ void AdaGrad::start()
 
   // 1. Iterate
 
-  for (int epoch = 0; epoch < iters; epoch++)
+  for (int epoch = 0; epoch < epochs; epoch++)
   {
     log("\n -- Epoch #{} --\n\n", epoch);
     //log("x = {}\n\n", x);
+    const Timestamp start = Clock::now();
+    double train_loss = 0.;
 
     for (int batch = 0; batch < batches; batch++)
     {
       Score s = tuner->score(x);
-
-      log("{}\n", momentum(s.grad));
+      train_loss += s.loss / batches;
 
       if (!(batch % 100))
       {
@@ -556,7 +786,7 @@ void AdaGrad::start()
       g += s.grad * s.grad;
       x -= adagrad_update(lrate, eps, g, s.grad);
 
-      if (!(epoch % 10))
+      if (!(epoch % 10) && batch == batches - 1)
       {
         ofstream fout("learning/adagrad.results");
         fout << format("Epoch #{}\n{}\n{}\n\n{}\n\n{}\n\n",
@@ -566,7 +796,93 @@ void AdaGrad::start()
       
       tuner->next_iter();
     }
+
+    log("Epoch #{} | Train loss = {} | Valid loss = {}\n",
+      epoch, train_loss, tuner->validate(x));
+    log("Epoch #{} took {} ms with {} threads\n", epoch, elapsed(start), tuner->get_threads());
+  }
+}
+
+Adam::Adam(std::unique_ptr<Tuner> tuner,
+           double learning_rate, double weight_decay, int max_epochs,
+           double beta1, double beta2, double eps)
+  : tuner(move(tuner)), lrate(learning_rate), decay(weight_decay),
+    beta1(beta1), beta2(beta2), eps(eps), epochs(max_epochs)
+{}
+
+// The best tune on held-out positions is saved, or the last one
+//  if there are none
+
+void Adam::start()
+{
+  const int batches = (int)(tuner->train_n() / tuner->batch_n());
+
+  log("-- Starting eval tuning ({})\n\n", decay ? "AdamW" : "Adam");
+  log("Total parameters: {}\n", Param_N);
+  log("Batches per epoch: {}\n", batches);
+
+  // 0. Init starting points
+
+  Tune m{}, v{}, x = E->to_tune();
+  double beta1_t = 1., beta2_t = 1.;
+  double best = tuner->validate(x);
+
+  log("Valid loss = {}\n", best);
+
+  // 1. Iterate
+
+  for (int epoch = 0; epoch < epochs; epoch++)
+  {
+    const Timestamp start = Clock::now();
+    double train_loss = 0.;
+
+    for (int batch = 0; batch < batches; batch++)
+    {
+      Score s = tuner->score(x);
+      train_loss += s.loss / batches;
+
+      m *= beta1;
+      m += (1 - beta1) * s.grad;
+      v *= beta2;
+      v += (1 - beta2) * (s.grad * s.grad);
+
+      beta1_t *= beta1;
+      beta2_t *= beta2;
+      const double step = lrate * std::sqrt(1 - beta2_t) / (1 - beta1_t);
+
+      if (decay) x -= lrate * decay * x;
+      x -= adam_update(step, eps, m, v);
+
+      tuner->next_iter();
+    }
+
+    const double valid_loss = tuner->validate(x);
+    log("Epoch #{} | Train loss = {} | Valid loss = {} | {} ms\n",
+      epoch, train_loss, valid_loss, elapsed(start));
+
+    if (valid_loss <= best)
+    {
+      best = valid_loss;
+      ofstream fout("learning/adam.results");
+      fout << format("Epoch #{}\n{}\n{}\n\n{}\n\n",
+        epoch, train_loss, valid_loss, x);
+    }
+  }
+}
+
+// Sums of threads in log2(threads) parallel steps, the result
+//  is left in grads[0]
+
+Tune reduce(vector<Tune> & grads, int threads)
+{
+  const int n = static_cast<int>(grads.size());
+  for (int step = 1; step < n; step *= 2)
+  {
+    #pragma omp parallel for num_threads(threads)
+    for (int i = 0; i < n - step; i += 2 * step)
+      grads[i] += grads[i + step];
   }
+  return grads[0];
 }
 
 // Golden Section Search for optimal K that minimizes loss
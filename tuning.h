@@ -3,6 +3,7 @@
 #include <vector>
 #include <random>
 #include <memory>
+#include <span>
 #include "solver_pvs.h"
 #include "eval.h"
 #include "book.h"
@@ -14,7 +15,7 @@ using std::string;
 using std::vector;
 
 constexpr double Lambda = 0; //1e-6;
-constexpr int MaxThreads = 2;
+constexpr int Flush_N = 1024; // positions per float gradient buffer
 
 
 // --------------------------------------------------------------------
@@ -100,18 +101,25 @@ struct PosResult
   int result;
 };
 
+// Datasets are read from mapped files line by line, scan() gives
+//  fens as views into the file to callback without storing them
+
 class DataProvider
 {
   vector<PosResult> & poss;
 
 public:
+  using Callback = std::function<void(std::string_view fen, int result)>;
+
   DataProvider(vector<PosResult> & poss) : poss(poss) {}
   bool open(string file);
 
+  static bool scan(string file, const Callback & fn);
+
 private:
-  bool open_csv(string file);
-  bool open_epd(string file);
-  bool open_book(string file);
+  static bool scan_csv(string file, const Callback & fn);
+  static bool scan_epd(string file, const Callback & fn);
+  static bool scan_book(string file, const Callback & fn);
 };
 
 
@@ -154,8 +162,13 @@ struct Score
 
 class Tuner
 {
+protected:
+  int threads = omp_get_max_threads();
+
 public:
   virtual ~Tuner() {}
+  void set_threads(int count) { threads = count > 0 ? count : omp_get_max_threads(); }
+  int  get_threads() const { return threads; }
   virtual Score  score(const Tune & v, double k0 = 0.) = 0;
   virtual void   next_iter() = 0;
   virtual Bounds get_bounds() const = 0;
@@ -164,6 +177,8 @@ public:
   virtual bool   open(string file) = 0;
   virtual size_t batch_n() const = 0;
   virtual size_t size() const = 0;
+  virtual size_t train_n() const { return size(); }
+  virtual double validate(const Tune & v, double k0 = 0.) { return 0.; } // held-out loss
 };
 
 
@@ -171,7 +186,8 @@ public:
 
 class TunerStatic : public Tuner
 {
-  Board B;
+  vector<Board> boards; // per thread
+  vector<unique_ptr<Eval>> evals;
   unique_ptr<Loss> L;
   vector<PosResult> poss;
   int batch_sz, index = 0;
@@ -191,53 +207,97 @@ public:
   size_t size() const { return poss.size(); }
 
 private:
-  Tune calc_dE(const Trace & trace) const;
+  void update_grad(Tune & grad, double df, const Trace & trace) const;
 };
 
 
 // Cached tuner - fits tune to position-result dataset
 // Shrinking traces removing params that are not activated in position
 
-// amount: [ idx val ] [ idx val ] [ idx val ] [ idx val ] [ idx val ] ...
+// index:  [ idx ] [ idx ] [ idx ] [ idx ] [ idx ] ...
+// value:  [ val ] [ val ] [ val ] [ val ] [ val ] ...
 // posidx:  ^- [ 0 3 col rho phi wdl rest ] ... ^- [ 3 7 col rho phi wdl rest ] ...
+//
+// Indices and values go in separate streams for vector gathers
 
 struct PosIndex
 {
-  int offset, size;
+  i64 offset; // streams may go past 2^31 amounts
+  int size;
   Color color;
   float factor[2], wdl;
   double rest;
 };
 
-struct Amount
-{
-  int index;
-  float val;
+// Traces are saved next to dataset as '<file>.cache' and later
+//  mapped to memory as is: header, posis, indices, values. Header tells
+//  if the cache is still valid for dataset, eval and its params,
+//  dataset is checked by size, write time and hash of its ends
+
+struct alignas(64) CacheHeader
+{
+  char magic[4] = {'E', 'I', 'A', 'T'};
+  u32 version = 3;
+  u32 param_n = Param_N;
+  u32 posi_sz = sizeof(PosIndex);
+  u32 amount_sz = sizeof(i32) + sizeof(float);
+  u64 source_sz = 0; // dataset file
+  i64 source_time = 0;
+  u64 source_hash = 0; // of its head and tail
+  u64 eval_key = 0;  // terms and params used for traces
+  u64 posi_n = 0;
+  u64 amount_n = 0;
+
+  bool fits(const CacheHeader & h) const;
 };
 
 class TunerCached : public Tuner
 {
   Board B;
   unique_ptr<Loss> L;
-  vector<PosIndex> posis;
-  vector<Amount> amounts;
+  std::span<const PosIndex> posis; // own or mapped ones
+  std::span<const i32> indices;
+  std::span<const float> values;
+  vector<PosIndex> own_posis;
+  vector<i32> own_indices;
+  vector<float> own_values;
+  MappedFile cache;
+
+  // Positions are never moved, batches go over shuffled training
+  //  indices, the held-out part is split once with fixed seed
+
+  vector<int> order, valid;
+  int batch_sz, index = 0;
+  double valid_part;
+  std::mt19937 gen;
 
 public:
-  TunerCached(unique_ptr<Loss> loss_fn) : L(move(loss_fn)) {}
+  TunerCached(unique_ptr<Loss> loss_fn, int batch_size = 0, double valid_part = 0.)
+    : L(move(loss_fn)), batch_sz(batch_size), valid_part(valid_part)
+  {}
 
   Score  score(const Tune & v, double k0 = 0.) override;
-  void   next_iter() override {}
+  void   next_iter() override;
   Bounds get_bounds() const override { return E->bounds(); }
   Tune   get_init() const override { return E->to_tune(); }
   string to_string(const Tune & v) override { return Eval(v).to_string(); }
   bool   open(string file) override;
-  size_t batch_n() const { return size(); }
+  size_t batch_n() const { return batch_sz ? std::min<size_t>(batch_sz, train_n()) : train_n(); }
   size_t size() const { return posis.size(); }
+  size_t train_n() const override { return order.size(); }
+  double validate(const Tune & v, double k0 = 0.) override;
 
 private:
+  CacheHeader cache_header(string file) const;
+  bool load_cache(string file);
+  bool save_cache(string file) const;
+  void split();
+
+  Score  pass(const Tune & v, double k, std::span<const int> ids, bool grads) const;
   double calc_eval(const Tune & v, int pos_idx) const;
+  double calc_eval(const float * w, int pos_idx) const;
   Tune   calc_dE(const Tune & v, int pos_idx) const;
-  void   update_grad(Tune & grad, double df, int pos_idx) const;
+  void   update_grad(float * grad, double df, int pos_idx) const;
 };
 
 
@@ -313,12 +373,35 @@ class AdaGrad
 {
   unique_ptr<Tuner> tuner;
   double lrate, lambda, eps;
-  int iters;
+  int epochs;
 
 public:
   AdaGrad(unique_ptr<Tuner> tuner,
           double learning_rate = 0.01,
-          double eps = 1e-8);
+          double eps = 1e-8,
+          int    max_epochs = 10'000);
+
+  void start();
+};
+
+
+// Adaptive Moment Estimation (Adam)
+// AdamW if weight decay is set, it is decoupled from gradient
+
+class Adam
+{
+  unique_ptr<Tuner> tuner;
+  double lrate, decay, beta1, beta2, eps;
+  int epochs;
+
+public:
+  Adam(unique_ptr<Tuner> tuner,
+       double learning_rate = 0.1,
+       double weight_decay = 0.,
+       int    max_epochs = 1000,
+       double beta1 = 0.9,
+       double beta2 = 0.999,
+       double eps = 1e-8);
 
   void start();
 };
@@ -328,6 +411,7 @@ public:
 // --------------------------------------------------------------------
 
 extern double find_k(unique_ptr<Tuner> tuner, Tune v, double a, double b, double eps = 1e-8);
+extern Tune reduce(vector<Tune> & grads, int threads);
 
 static Tune operator * (double val, const Tune & v)
 {
@@ -491,6 +575,17 @@ static Tune adagrad_update(f64 lrate, f64 eps, const Tune & g, const Tune & grad
   return r;
 }
 
+static Tune adam_update(f64 lrate, f64 eps, const Tune & m, const Tune & v)
+{
+  Tune r;
+  for (int i = 0; i < Param_N; i++)
+  {
+    r.param[i][0] = lrate * m.param[i][0] / (std::sqrt(v.param[i][0]) + eps);
+    r.param[i][1] = lrate * m.param[i][1] / (std::sqrt(v.param[i][1]) + eps);
+  }
+  return r;
+}
+
 }
 
 template<>
@@ -1,6 +1,19 @@
 #pragma once
+#ifdef _WIN32
 #include <windows.h>
-#include <conio.h>
+#else
+#include <unistd.h>
+#endif
+#ifdef _MSC_VER
+#include <intrin.h>
+#include <malloc.h>
+#include <xmmintrin.h>
+#endif
+#ifndef _WIN32
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#endif
 #include <functional>
 #include <cmath>
 #include <cassert>
@@ -10,6 +23,7 @@
 #include <iostream>
 #include <charconv>
 #include <algorithm>
+#include <cstdlib>
 #include <omp.h>
 #include "types.h"
 #include "consts.h"
@@ -26,6 +40,52 @@ template<typename T> INLINE T abs(T val)
   return val < T(0) ? -val : val;
 }
 
+inline u64 mul_hi(u64 a, u64 b) // high half of 128-bit product
+{
+#ifdef _MSC_VER
+  return __umulh(a, b);
+#else
+  return static_cast<u64>((static_cast<unsigned __int128>(a) * b) >> 64);
+#endif
+}
+
+inline void prefetch(const void * addr)
+{
+#ifdef _MSC_VER
+  _mm_prefetch(static_cast<const char *>(addr), _MM_HINT_T0);
+#else
+  __builtin_prefetch(addr);
+#endif
+}
+
+// Memory for big tables is aligned to 2 mb, so on Linux
+//  it may be backed by transparent huge pages
+
+constexpr size_t Huge_Page = 2ull << 20;
+
+inline void * large_alloc(size_t size)
+{
+  size = (size + Huge_Page - 1) / Huge_Page * Huge_Page;
+#ifdef _MSC_VER
+  return _aligned_malloc(size, Huge_Page);
+#else
+  void * mem = std::aligned_alloc(Huge_Page, size);
+#ifdef MADV_HUGEPAGE
+  if (mem) madvise(mem, size, MADV_HUGEPAGE);
+#endif
+  return mem;
+#endif
+}
+
+inline void large_free(void * mem)
+{
+#ifdef _MSC_VER
+  _aligned_free(mem);
+#else
+  std::free(mem);
+#endif
+}
+
 inline double sigmoid(double x, double k = Tunes::K100) // [0; 1]
 {
   return 1 / (1 + exp(-k * x));
@@ -53,6 +113,17 @@ INLINE std::string cut(std::string & str, std::string delim = " ")
   return part;
 }
 
+// The same over view, part and rest point into the source
+
+INLINE std::string_view cut(std::string_view & str, std::string_view delim = " ")
+{
+  auto pos = str.find(delim);
+  std::string_view part = str.substr(0, pos);
+  str = pos == std::string_view::npos ? str.substr(str.length())
+      : str.substr(pos + delim.length());
+  return part;
+}
+
 INLINE void dry(std::string & str, std::string_view chars = "\n")
 {
   size_t pos = str.length();
@@ -128,6 +199,13 @@ inline int parse_int(const std::string_view str, int def = 0, int base = 10)
   return static_cast<int>(result);
 }
 
+inline u64 parse_u64(const std::string_view str, u64 def = 0ull)
+{
+  u64 result = def;
+  std::from_chars(str.data(), str.data() + str.size(), result);
+  return result;
+}
+
 inline double parse_double(const std::string_view str, double def = 0.)
 {
   double result = def;
@@ -189,22 +267,15 @@ IQR_Stats iqr_stats(std::vector<T> vec, double k = 1.5)
 
 class InputHandler
 {
+#ifdef _WIN32
   DWORD mode;
   HANDLE handle = GetStdHandle(STD_INPUT_HANDLE);
   BOOL console = GetConsoleMode(handle, &mode);
+#else
+  bool console = isatty(STDIN_FILENO);
+#endif
 
 public:
-  inline bool available()
-  {
-    if (!console)
-    {
-      DWORD bytes_avail;
-      if (!PeekNamedPipe(handle, 0, 0, 0, &bytes_avail, 0)) return true;
-      return bytes_avail > 0;
-    }
-    else return _kbhit();
-  }
-
   inline bool is_console() const
   {
     return console;
@@ -213,6 +284,107 @@ public:
 
 static InputHandler Input;
 
+// Read-only file mapped to memory, pages are shared
+//  with other processes that map the same file
+
+class MappedFile
+{
+  const char * data = nullptr;
+  size_t length = 0;
+#ifdef _WIN32
+  HANDLE file = INVALID_HANDLE_VALUE;
+  HANDLE mapping = nullptr;
+#endif
+
+public:
+  MappedFile() = default;
+  ~MappedFile() { close(); }
+
+  MappedFile(const MappedFile &) = delete;
+  MappedFile & operator = (const MappedFile &) = delete;
+
+  bool open(const std::string & path)
+  {
+    close();
+#ifdef _WIN32
+    file = CreateFileA(path.c_str(), GENERIC_READ, FILE_SHARE_READ, nullptr,
+                       OPEN_EXISTING, FILE_ATTRIBUTE_NORMAL, nullptr);
+    if (file == INVALID_HANDLE_VALUE) return false;
+
+    LARGE_INTEGER sz;
+    if (!GetFileSizeEx(file, &sz) || !sz.QuadPart) { close(); return false; }
+
+    mapping = CreateFileMappingA(file, nullptr, PAGE_READONLY, 0, 0, nullptr);
+    if (!mapping) { close(); return false; }
+
+    data = static_cast<const char *>(MapViewOfFile(mapping, FILE_MAP_READ, 0, 0, 0));
+    length = static_cast<size_t>(sz.QuadPart);
+#else
+    const int fd = ::open(path.c_str(), O_RDONLY);
+    if (fd < 0) return false;
+
+    struct stat st;
+    if (fstat(fd, &st) || !st.st_size) { ::close(fd); return false; }
+
+    void * mem = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    ::close(fd); // mapping keeps the file
+    if (mem == MAP_FAILED) return false;
+
+    data = static_cast<const char *>(mem);
+    length = static_cast<size_t>(st.st_size);
+#endif
+    if (!data) close();
+    return !!data;
+  }
+
+  void close()
+  {
+#ifdef _WIN32
+    if (data) UnmapViewOfFile(data);
+    if (mapping) CloseHandle(mapping);
+    if (file != INVALID_HANDLE_VALUE) CloseHandle(file);
+    mapping = nullptr;
+    file = INVALID_HANDLE_VALUE;
+#else
+    if (data) munmap(const_cast<char *>(data), length);
+#endif
+    data = nullptr;
+    length = 0;
+  }
+
+  const char * get() const { return data; }
+  size_t size() const { return length; }
+};
+
+// Lines of mapped file one by one as views into it, so
+//  nothing is copied and the file is never loaded whole
+
+class LineReader
+{
+  MappedFile file;
+  size_t pos = 0;
+
+public:
+  bool open(const std::string & path)
+  {
+    pos = 0;
+    return file.open(path);
+  }
+
+  bool next(std::string_view & line)
+  {
+    if (pos >= file.size()) return false;
+
+    std::string_view rest(file.get() + pos, file.size() - pos);
+    const size_t end = std::min(rest.find('\n'), rest.size());
+
+    line = rest.substr(0, end);
+    if (line.ends_with('\r')) line.remove_suffix(1);
+    pos += end + 1;
+    return true;
+  }
+};
+
 template<bool flush = false, typename... Args>
 INLINE void say(std::format_string<Args...> fmt, Args&&... args)
 {
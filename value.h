@@ -44,7 +44,7 @@ namespace eia {
   static INLINE bool is_lose(Val v) { return v < -Mate; }
   static INLINE bool decisive(Val v) { return is_win(v) || is_lose(v); }
   
-  static INLINE Val operator * (Val a, Val b)
+  static inline Val operator * (Val a, Val b)
   {
     assert(false);     // usually we don't like that, but trying
     return a * dry(b); //  to resolve it in most gracious way
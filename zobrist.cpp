@@ -9,7 +9,7 @@ u64 pk_key[Piece_N][SQ_N];
 u64 key[Piece_N][SQ_N];
 u64 castle[Castling_N];
 u64 ep[SQ_N + 1];
-u64 turn = [&]() -> u64
+u64 turn = []() -> u64
 {
   mt19937_64 gen(0xC0FFEE);
   uniform_int_distribution<u64> distr;